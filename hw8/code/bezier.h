@@ -0,0 +1,280 @@
+#ifndef BEZIER_H
+#define BEZIER_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+// Evaluates the Bezier curve defined by count control points at t, Horner-style in the Bernstein basis (O(n))
+inline glm::vec2 bezierPoint(const glm::vec2 *points, int count, float t)
+{
+	if (count <= 0)
+		return glm::vec2(0.0f);
+	int n = count - 1;
+	if (n == 0)
+		return points[0];
+	float s = 1.0f - t;
+	float power = 1.0f;
+	float binom = 1.0f;
+	glm::vec2 result = points[0] * s;
+	for (int i = 1; i < n; i++)
+	{
+		power *= t;
+		binom = binom * (float)(n - i + 1) / (float)i;
+		result = (result + points[i] * (power * binom)) * s;
+	}
+	return result + points[n] * (power * t);
+}
+
+inline glm::vec2 bezierPoint(const std::vector<glm::vec2> &points, float t)
+{
+	return bezierPoint(points.data(), (int)points.size(), t);
+}
+
+// Binomial coefficient, usable in constant expressions
+constexpr int binomial(int n, int k)
+{
+	return k == 0 || k == n ? 1 : binomial(n - 1, k - 1) + binomial(n - 1, k);
+}
+
+// Compile-time table entry, so the coefficients cost nothing at run time
+template <int N, int K>
+struct BinomialTable
+{
+	static constexpr float value = (float)binomial(N, K);
+};
+
+// Fills p[0..I] with the powers of x, unrolled by template recursion
+template <int I>
+struct PowerTable
+{
+	static void fill(float x, float *p)
+	{
+		PowerTable<I - 1>::fill(x, p);
+		p[I] = p[I - 1] * x;
+	}
+};
+
+template <>
+struct PowerTable<0>
+{
+	static void fill(float /*x*/, float *p)
+	{
+		p[0] = 1.0f;
+	}
+};
+
+// Sum of the Bernstein terms 0..I of a degree N curve, unrolled by template recursion
+template <int N, int I>
+struct BernsteinSum
+{
+	static void add(const glm::vec2 *points, const float *tp, const float *sp, float &x, float &y)
+	{
+		BernsteinSum<N, I - 1>::add(points, tp, sp, x, y);
+		float b = BinomialTable<N, I>::value * tp[I] * sp[N - I];
+		x += points[I].x * b;
+		y += points[I].y * b;
+	}
+};
+
+template <int N>
+struct BernsteinSum<N, 0>
+{
+	static void add(const glm::vec2 *points, const float * /*tp*/, const float *sp, float &x, float &y)
+	{
+		x = points[0].x * sp[N];
+		y = points[0].y * sp[N];
+	}
+};
+
+// Bezier evaluation specialized for a fixed degree: no loops over the control points,
+// no run-time binomials and no pow calls, only the powers of t and 1 - t
+template <int Degree>
+struct BezierEvaluator
+{
+	static glm::vec2 evaluate(const glm::vec2 *points, float t)
+	{
+		float tp[Degree + 1], sp[Degree + 1];
+		PowerTable<Degree>::fill(t, tp);
+		PowerTable<Degree>::fill(1.0f - t, sp);
+		float x, y;
+		BernsteinSum<Degree, Degree>::add(points, tp, sp, x, y);
+		return glm::vec2(x, y);
+	}
+
+	static void evaluate(const glm::vec2 *points, const float *t, int count, glm::vec2 *out)
+	{
+		for (int i = 0; i < count; i++)
+			out[i] = evaluate(points, t[i]);
+	}
+};
+
+// Largest degree with a specialized evaluator; higher degrees use bezierPoint
+const int MAX_SPECIALIZED_DEGREE = 7;
+
+// Evaluates a curve of any degree at t, dispatching to the specialized evaluators for degrees 1 to 7
+inline glm::vec2 evaluateBezier(const glm::vec2 *points, int count, float t)
+{
+	switch (count - 1)
+	{
+	case 1: return BezierEvaluator<1>::evaluate(points, t);
+	case 2: return BezierEvaluator<2>::evaluate(points, t);
+	case 3: return BezierEvaluator<3>::evaluate(points, t);
+	case 4: return BezierEvaluator<4>::evaluate(points, t);
+	case 5: return BezierEvaluator<5>::evaluate(points, t);
+	case 6: return BezierEvaluator<6>::evaluate(points, t);
+	case 7: return BezierEvaluator<7>::evaluate(points, t);
+	default: return bezierPoint(points, count, t);
+	}
+}
+
+// Batch form of evaluateBezier: dispatches once and evaluates count parameters
+inline void evaluateBezier(const glm::vec2 *points, int count, const float *t, int samples, glm::vec2 *out)
+{
+	switch (count - 1)
+	{
+	case 1: BezierEvaluator<1>::evaluate(points, t, samples, out); break;
+	case 2: BezierEvaluator<2>::evaluate(points, t, samples, out); break;
+	case 3: BezierEvaluator<3>::evaluate(points, t, samples, out); break;
+	case 4: BezierEvaluator<4>::evaluate(points, t, samples, out); break;
+	case 5: BezierEvaluator<5>::evaluate(points, t, samples, out); break;
+	case 6: BezierEvaluator<6>::evaluate(points, t, samples, out); break;
+	case 7: BezierEvaluator<7>::evaluate(points, t, samples, out); break;
+	default:
+		for (int i = 0; i < samples; i++)
+			out[i] = bezierPoint(points, count, t[i]);
+		break;
+	}
+}
+
+// Control points of the hodograph: B'(t) is a Bezier curve of degree n - 1 over n * (P[i + 1] - P[i])
+inline std::vector<glm::vec2> bezierHodograph(const std::vector<glm::vec2> &points)
+{
+	std::vector<glm::vec2> derivative;
+	if (points.size() < 2)
+		return derivative;
+	float n = (float)(points.size() - 1);
+	derivative.reserve(points.size() - 1);
+	for (size_t i = 0; i + 1 < points.size(); i++)
+		derivative.push_back((points[i + 1] - points[i]) * n);
+	return derivative;
+}
+
+// Arc-length lookup table of a Bezier curve. It is built once whenever the control points change:
+// the parameter range is split into equal segments, each segment length is integrated with 5-point
+// Gauss-Legendre quadrature, and t(s) is interpolated with a monotone cubic Hermite spline whose
+// knot slopes are 1 / |B'(t)|. Queries are a binary search plus one spline evaluation.
+class ArcLengthTable
+{
+public:
+	ArcLengthTable() : totalLength(0.0f) {}
+
+	// Rebuilds the table for the given control points. Higher degrees get more segments.
+	void build(const std::vector<glm::vec2> &points, int segments = 0)
+	{
+		params.clear();
+		lengths.clear();
+		slopes.clear();
+		totalLength = 0.0f;
+		if (points.size() < 2)
+			return;
+		if (segments <= 0)
+			segments = std::max(32, 8 * (int)points.size());
+
+		static const float nodes[5] = { 0.0f, -0.5384693101f, 0.5384693101f, -0.9061798459f, 0.9061798459f };
+		static const float weights[5] = { 0.5688888889f, 0.4786286705f, 0.4786286705f, 0.2369268851f, 0.2369268851f };
+
+		std::vector<glm::vec2> derivative = bezierHodograph(points);
+		const glm::vec2 *d = derivative.data();
+		int count = (int)derivative.size();
+
+		params.resize(segments + 1);
+		lengths.resize(segments + 1);
+		slopes.resize(segments + 1);
+		lengths[0] = 0.0f;
+		for (int k = 0; k <= segments; k++)
+			params[k] = (float)k / (float)segments;
+		for (int k = 0; k < segments; k++)
+		{
+			float half = 0.5f * (params[k + 1] - params[k]);
+			float mid = 0.5f * (params[k + 1] + params[k]);
+			float sum = 0.0f;
+			for (int q = 0; q < 5; q++)
+				sum += weights[q] * glm::length(evaluateBezier(d, count, mid + half * nodes[q]));
+			lengths[k + 1] = lengths[k] + sum * half;
+		}
+		totalLength = lengths[segments];
+
+		// dt/ds at every knot, limited with Fritsch-Carlson so that t(s) stays monotone even at cusps
+		for (int k = 0; k <= segments; k++)
+		{
+			float speed = glm::length(evaluateBezier(d, count, params[k]));
+			slopes[k] = speed > 1e-6f ? 1.0f / speed : 1e6f;
+		}
+		for (int k = 0; k < segments; k++)
+		{
+			float h = lengths[k + 1] - lengths[k];
+			if (h <= 0.0f)
+			{
+				slopes[k] = slopes[k + 1] = 0.0f;
+				continue;
+			}
+			float secant = (params[k + 1] - params[k]) / h;
+			float alpha = slopes[k] / secant;
+			float beta = slopes[k + 1] / secant;
+			float norm = alpha * alpha + beta * beta;
+			if (norm > 9.0f)
+			{
+				float tau = 3.0f / std::sqrt(norm);
+				slopes[k] = tau * alpha * secant;
+				slopes[k + 1] = tau * beta * secant;
+			}
+		}
+	}
+
+	float length() const
+	{
+		return totalLength;
+	}
+
+	// Returns the curve parameter t whose arc length from t = 0 is distance, in O(log n)
+	float parameterAt(float distance) const
+	{
+		if (lengths.size() < 2 || totalLength <= 0.0f)
+			return 0.0f;
+		if (distance <= 0.0f)
+			return 0.0f;
+		if (distance >= totalLength)
+			return 1.0f;
+		size_t k = std::upper_bound(lengths.begin(), lengths.end(), distance) - lengths.begin() - 1;
+		k = std::min(k, lengths.size() - 2);
+		float h = lengths[k + 1] - lengths[k];
+		if (h <= 0.0f)
+			return params[k];
+		float x = (distance - lengths[k]) / h;
+		float x2 = x * x, x3 = x2 * x;
+		float h00 = 2 * x3 - 3 * x2 + 1;
+		float h10 = x3 - 2 * x2 + x;
+		float h01 = -2 * x3 + 3 * x2;
+		float h11 = x3 - x2;
+		return h00 * params[k] + h10 * h * slopes[k] + h01 * params[k + 1] + h11 * h * slopes[k + 1];
+	}
+
+	// Same as parameterAt, with the distance given as a fraction of the whole curve length
+	float parameterAtFraction(float u) const
+	{
+		if (totalLength <= 0.0f)
+			return u;
+		return parameterAt(u * totalLength);
+	}
+
+private:
+	std::vector<float> params;
+	std::vector<float> lengths;
+	std::vector<float> slopes;
+	float totalLength;
+};
+
+#endif
@@ -0,0 +1,602 @@
+#ifndef BLOCKCOMPRESS_H
+#define BLOCKCOMPRESS_H
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BLOCK_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+// GPU block compression formats the texture cache can store. Every format codes 4x4 texels:
+// BC1 as 8 bytes of opaque RGB, BC3 and BC7 as 16 bytes of RGBA.
+enum BlockFormat
+{
+	BLOCK_NONE = 0,
+	BLOCK_BC1 = 1,
+	BLOCK_BC3 = 2,
+	BLOCK_BC7 = 3
+};
+
+inline const char *blockFormatName(int format)
+{
+	switch (format)
+	{
+	case BLOCK_BC1:
+		return "BC1";
+	case BLOCK_BC3:
+		return "BC3";
+	case BLOCK_BC7:
+		return "BC7";
+	default:
+		return "raw";
+	}
+}
+
+inline int blockBytes(int format)
+{
+	return format == BLOCK_BC1 ? 8 : 16;
+}
+
+inline size_t compressedSize(int width, int height, int format)
+{
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+// The 16 texels of a block as separate channels, so four texels fit in one SSE register
+struct BlockPixels
+{
+	float r[16], g[16], b[16], a[16];
+};
+
+// Picks the nearest palette entry for every texel, four texels per step. Channels is 3 to
+// ignore alpha or 4 to include it; palette entries are RGBA.
+inline float nearestIndices(const BlockPixels &block, const float palette[][4], int count, int channels, int indices[16])
+{
+	float error = 0.0f;
+#ifdef BLOCK_USE_SSE
+	for (int i = 0; i < 16; i += 4)
+	{
+		__m128 r = _mm_loadu_ps(block.r + i), g = _mm_loadu_ps(block.g + i), b = _mm_loadu_ps(block.b + i), a = _mm_loadu_ps(block.a + i);
+		__m128 best = _mm_set1_ps(1e30f);
+		__m128 bestIndex = _mm_setzero_ps();
+		for (int j = 0; j < count; j++)
+		{
+			__m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[j][0]));
+			__m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[j][1]));
+			__m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[j][2]));
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+			if (channels == 4)
+			{
+				__m128 da = _mm_sub_ps(a, _mm_set1_ps(palette[j][3]));
+				d = _mm_add_ps(d, _mm_mul_ps(da, da));
+			}
+			__m128 closer = _mm_cmplt_ps(d, best);
+			best = _mm_min_ps(d, best);
+			bestIndex = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps((float)j)), _mm_andnot_ps(closer, bestIndex));
+		}
+		float distances[4], found[4];
+		_mm_storeu_ps(distances, best);
+		_mm_storeu_ps(found, bestIndex);
+		for (int k = 0; k < 4; k++)
+		{
+			indices[i + k] = (int)found[k];
+			error += distances[k];
+		}
+	}
+#else
+	for (int i = 0; i < 16; i++)
+	{
+		float best = 1e30f;
+		for (int j = 0; j < count; j++)
+		{
+			float dr = block.r[i] - palette[j][0], dg = block.g[i] - palette[j][1], db = block.b[i] - palette[j][2];
+			float d = dr * dr + dg * dg + db * db;
+			if (channels == 4)
+				d += (block.a[i] - palette[j][3]) * (block.a[i] - palette[j][3]);
+			if (d < best)
+			{
+				best = d;
+				indices[i] = j;
+			}
+		}
+		error += best;
+	}
+#endif
+	return error;
+}
+
+// Principal axis of the block colors through their mean, by power iteration on the covariance.
+// Channels is 3 or 4; the returned axis is zero for a block of one color.
+inline void principalAxis(const BlockPixels &block, int channels, float mean[4], float axis[4])
+{
+	const float *values[4] = { block.r, block.g, block.b, block.a };
+	for (int c = 0; c < 4; c++)
+	{
+		mean[c] = 0.0f;
+		for (int i = 0; i < 16; i++)
+			mean[c] += values[c][i];
+		mean[c] /= 16.0f;
+	}
+	float covariance[4][4] = {};
+	for (int i = 0; i < 16; i++)
+	{
+		for (int c = 0; c < channels; c++)
+			for (int d = c; d < channels; d++)
+				covariance[c][d] += (values[c][i] - mean[c]) * (values[d][i] - mean[d]);
+	}
+	for (int c = 0; c < channels; c++)
+		for (int d = 0; d < c; d++)
+			covariance[c][d] = covariance[d][c];
+	// start from the channel with the largest spread
+	int widest = 0;
+	for (int c = 1; c < channels; c++)
+	{
+		if (covariance[c][c] > covariance[widest][widest])
+			widest = c;
+	}
+	float v[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	v[widest] = 1.0f;
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int c = 0; c < channels; c++)
+			for (int d = 0; d < channels; d++)
+				next[c] += covariance[c][d] * v[d];
+		float length = 0.0f;
+		for (int c = 0; c < channels; c++)
+			length += next[c] * next[c];
+		length = std::sqrt(length);
+		if (length < 1e-6f)
+			break;
+		for (int c = 0; c < channels; c++)
+			v[c] = next[c] / length;
+	}
+	for (int c = 0; c < 4; c++)
+		axis[c] = c < channels && covariance[widest][widest] > 1e-6f ? v[c] : 0.0f;
+}
+
+// Endpoints at the extremes of the block's projection on its principal axis
+inline void axisEndpoints(const BlockPixels &block, int channels, float low[4], float high[4])
+{
+	float mean[4], axis[4];
+	principalAxis(block, channels, mean, axis);
+	float minT = 0.0f, maxT = 0.0f;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = (block.r[i] - mean[0]) * axis[0] + (block.g[i] - mean[1]) * axis[1] + (block.b[i] - mean[2]) * axis[2] + (block.a[i] - mean[3]) * axis[3];
+		minT = std::min(minT, t);
+		maxT = std::max(maxT, t);
+	}
+	for (int c = 0; c < 4; c++)
+	{
+		low[c] = std::min(255.0f, std::max(0.0f, mean[c] + minT * axis[c]));
+		high[c] = std::min(255.0f, std::max(0.0f, mean[c] + maxT * axis[c]));
+	}
+	if (channels == 3)
+		low[3] = high[3] = 255.0f;
+}
+
+// ---------------------------------------------------------------------------------------------
+// BC1 color block: two RGB565 endpoints and 2 bit indices; c0 > c1 selects the four color mode
+
+inline unsigned short packRGB565(const float color[4])
+{
+	int r = (int)(color[0] * 31.0f / 255.0f + 0.5f), g = (int)(color[1] * 63.0f / 255.0f + 0.5f), b = (int)(color[2] * 31.0f / 255.0f + 0.5f);
+	return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+inline void unpackRGB565(unsigned short packed, float color[4])
+{
+	int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+	color[0] = (float)((r << 3) | (r >> 2));
+	color[1] = (float)((g << 2) | (g >> 4));
+	color[2] = (float)((b << 3) | (b >> 2));
+	color[3] = 255.0f;
+}
+
+inline void colorPalette(unsigned short c0, unsigned short c1, bool fourColors, float palette[4][4])
+{
+	unpackRGB565(c0, palette[0]);
+	unpackRGB565(c1, palette[1]);
+	for (int c = 0; c < 4; c++)
+	{
+		if (fourColors)
+		{
+			palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+			palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+		}
+		else
+		{
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2.0f;
+			palette[3][c] = 0.0f;
+		}
+	}
+}
+
+// Codes the block's color in four color mode; the indices are written for both orderings
+inline float encodeColorBlock(const BlockPixels &block, unsigned short &c0, unsigned short &c1, unsigned int &bits)
+{
+	float low[4], high[4];
+	axisEndpoints(block, 3, low, high);
+	float bestError = 1e30f;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		unsigned short e0 = packRGB565(high), e1 = packRGB565(low);
+		if (e0 < e1)
+			std::swap(e0, e1);
+		float palette[4][4];
+		colorPalette(e0, e1, true, palette);
+		int indices[16];
+		float error = nearestIndices(block, palette, 4, 3, indices);
+		if (error < bestError)
+		{
+			bestError = error;
+			c0 = e0;
+			c1 = e1;
+			bits = 0;
+			for (int i = 0; i < 16; i++)
+				bits |= (unsigned int)indices[i] << (2 * i);
+		}
+		if (pass == 1 || e0 == e1)
+			break;
+		// least squares refit of the endpoints to the chosen indices
+		static const float weight0[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+		float aa = 0.0f, bb = 0.0f, ab = 0.0f, ax[3] = {}, bx[3] = {};
+		const float *values[3] = { block.r, block.g, block.b };
+		for (int i = 0; i < 16; i++)
+		{
+			float alpha = weight0[indices[i]], beta = 1.0f - alpha;
+			aa += alpha * alpha;
+			bb += beta * beta;
+			ab += alpha * beta;
+			for (int c = 0; c < 3; c++)
+			{
+				ax[c] += alpha * values[c][i];
+				bx[c] += beta * values[c][i];
+			}
+		}
+		float determinant = aa * bb - ab * ab;
+		if (std::fabs(determinant) < 1e-6f)
+			break;
+		for (int c = 0; c < 3; c++)
+		{
+			high[c] = std::min(255.0f, std::max(0.0f, (ax[c] * bb - bx[c] * ab) / determinant));
+			low[c] = std::min(255.0f, std::max(0.0f, (bx[c] * aa - ax[c] * ab) / determinant));
+		}
+	}
+	return bestError;
+}
+
+inline void encodeBC1(const BlockPixels &block, unsigned char out[8])
+{
+	unsigned short c0, c1;
+	unsigned int bits;
+	encodeColorBlock(block, c0, c1, bits);
+	memcpy(out, &c0, 2);
+	memcpy(out + 2, &c1, 2);
+	memcpy(out + 4, &bits, 4);
+}
+
+inline void decodeColorBlock(const unsigned char in[8], bool alwaysFourColors, unsigned char rgba[64])
+{
+	unsigned short c0, c1;
+	unsigned int bits;
+	memcpy(&c0, in, 2);
+	memcpy(&c1, in + 2, 2);
+	memcpy(&bits, in + 4, 4);
+	float palette[4][4];
+	colorPalette(c0, c1, alwaysFourColors || c0 > c1, palette);
+	for (int i = 0; i < 16; i++)
+	{
+		const float *color = palette[(bits >> (2 * i)) & 3];
+		for (int c = 0; c < 3; c++)
+			rgba[4 * i + c] = (unsigned char)(color[c] + 0.5f);
+		rgba[4 * i + 3] = 255;
+	}
+}
+
+// ---------------------------------------------------------------------------------------------
+// BC3: an alpha block of two 8 bit endpoints and 3 bit indices, then a BC1 color block
+
+inline void alphaPalette(int a0, int a1, float palette[8])
+{
+	palette[0] = (float)a0;
+	palette[1] = (float)a1;
+	for (int i = 1; i < 7; i++)
+		palette[i + 1] = (float)(((7 - i) * a0 + i * a1 + 3) / 7);
+}
+
+inline void encodeBC3(const BlockPixels &block, unsigned char out[16])
+{
+	float lowest = 255.0f, highest = 0.0f;
+	for (int i = 0; i < 16; i++)
+	{
+		lowest = std::min(lowest, block.a[i]);
+		highest = std::max(highest, block.a[i]);
+	}
+	int a0 = (int)(highest + 0.5f), a1 = (int)(lowest + 0.5f);
+	float palette[8];
+	alphaPalette(a0, a1, palette);
+	unsigned long long bits = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int best = 0;
+		for (int j = 1; j < 8; j++)
+		{
+			if (std::fabs(block.a[i] - palette[j]) < std::fabs(block.a[i] - palette[best]))
+				best = j;
+		}
+		bits |= (unsigned long long)best << (3 * i);
+	}
+	out[0] = (unsigned char)a0;
+	out[1] = (unsigned char)a1;
+	for (int i = 0; i < 6; i++)
+		out[2 + i] = (unsigned char)(bits >> (8 * i));
+	encodeBC1(block, out + 8);
+}
+
+inline void decodeBC3(const unsigned char in[16], unsigned char rgba[64])
+{
+	decodeColorBlock(in + 8, true, rgba);
+	float palette[8];
+	// a0 <= a1 selects a six value mode with 0 and 255, which the encoder never writes
+	int a0 = in[0], a1 = in[1];
+	if (a0 > a1)
+	{
+		alphaPalette(a0, a1, palette);
+	}
+	else
+	{
+		palette[0] = (float)a0;
+		palette[1] = (float)a1;
+		for (int i = 1; i < 5; i++)
+			palette[i + 1] = (float)(((5 - i) * a0 + i * a1 + 2) / 5);
+		palette[6] = 0.0f;
+		palette[7] = 255.0f;
+	}
+	unsigned long long bits = 0;
+	for (int i = 0; i < 6; i++)
+		bits |= (unsigned long long)in[2 + i] << (8 * i);
+	for (int i = 0; i < 16; i++)
+		rgba[4 * i + 3] = (unsigned char)palette[(bits >> (3 * i)) & 7];
+}
+
+// ---------------------------------------------------------------------------------------------
+// BC7 mode 6: one subset, RGBA endpoints of 7 bits plus a p-bit each, 4 bit indices
+
+static const int BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Quantizes an endpoint to 7 bits per channel and the p-bit that fits it best
+inline void quantizeMode6(const float color[4], int quantized[4], int &pbit)
+{
+	float bestError = 1e30f;
+	for (int p = 0; p < 2; p++)
+	{
+		float error = 0.0f;
+		int candidate[4];
+		for (int c = 0; c < 4; c++)
+		{
+			candidate[c] = std::min(127, std::max(0, (int)((color[c] - p) / 2.0f + 0.5f)));
+			float value = (float)((candidate[c] << 1) | p);
+			error += (value - color[c]) * (value - color[c]);
+		}
+		if (error < bestError)
+		{
+			bestError = error;
+			pbit = p;
+			memcpy(quantized, candidate, sizeof(candidate));
+		}
+	}
+}
+
+inline void mode6Palette(const int e0[4], int p0, const int e1[4], int p1, float palette[16][4])
+{
+	for (int i = 0; i < 16; i++)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			int v0 = (e0[c] << 1) | p0, v1 = (e1[c] << 1) | p1;
+			palette[i][c] = (float)(((64 - BC7_WEIGHTS4[i]) * v0 + BC7_WEIGHTS4[i] * v1 + 32) >> 6);
+		}
+	}
+}
+
+// Appends bits to a 128 bit block, least significant first
+struct BlockWriter
+{
+	unsigned char *out;
+	int position;
+
+	explicit BlockWriter(unsigned char *out) : out(out), position(0)
+	{
+		memset(out, 0, 16);
+	}
+
+	void write(unsigned int value, int count)
+	{
+		for (int i = 0; i < count; i++, position++)
+		{
+			if ((value >> i) & 1)
+				out[position >> 3] |= (unsigned char)(1 << (position & 7));
+		}
+	}
+};
+
+inline unsigned int readBits(const unsigned char *in, int &position, int count)
+{
+	unsigned int value = 0;
+	for (int i = 0; i < count; i++, position++)
+		value |= (unsigned int)((in[position >> 3] >> (position & 7)) & 1) << i;
+	return value;
+}
+
+inline void encodeBC7(const BlockPixels &block, unsigned char out[16])
+{
+	float low[4], high[4];
+	axisEndpoints(block, 4, low, high);
+	int e0[4], e1[4], p0, p1;
+	quantizeMode6(low, e0, p0);
+	quantizeMode6(high, e1, p1);
+	float palette[16][4];
+	mode6Palette(e0, p0, e1, p1, palette);
+	int indices[16];
+	nearestIndices(block, palette, 16, 4, indices);
+	// the first index is stored with 3 bits, so its top bit must be clear
+	if (indices[0] & 8)
+	{
+		std::swap(e0, e1);
+		std::swap(p0, p1);
+		for (int i = 0; i < 16; i++)
+			indices[i] = 15 - indices[i];
+	}
+	BlockWriter writer(out);
+	writer.write(1 << 6, 7);
+	for (int c = 0; c < 4; c++)
+	{
+		writer.write(e0[c], 7);
+		writer.write(e1[c], 7);
+	}
+	writer.write(p0, 1);
+	writer.write(p1, 1);
+	writer.write(indices[0], 3);
+	for (int i = 1; i < 16; i++)
+		writer.write(indices[i], 4);
+}
+
+// Decodes mode 6 blocks only, the one mode the encoder writes
+inline void decodeBC7(const unsigned char in[16], unsigned char rgba[64])
+{
+	int position = 0;
+	if (readBits(in, position, 7) != (1 << 6))
+	{
+		memset(rgba, 0, 64);
+		return;
+	}
+	int e0[4], e1[4];
+	for (int c = 0; c < 4; c++)
+	{
+		e0[c] = (int)readBits(in, position, 7);
+		e1[c] = (int)readBits(in, position, 7);
+	}
+	int p0 = (int)readBits(in, position, 1), p1 = (int)readBits(in, position, 1);
+	float palette[16][4];
+	mode6Palette(e0, p0, e1, p1, palette);
+	for (int i = 0; i < 16; i++)
+	{
+		int index = (int)readBits(in, position, i == 0 ? 3 : 4);
+		for (int c = 0; c < 4; c++)
+			rgba[4 * i + c] = (unsigned char)palette[index][c];
+	}
+}
+
+// ---------------------------------------------------------------------------------------------
+
+// Reads the 4x4 block at (bx, by) of an RGBA image; texels past the edge repeat the last ones
+inline void fetchBlock(const unsigned char *rgba, int width, int height, int bx, int by, BlockPixels &block)
+{
+	for (int y = 0; y < 4; y++)
+	{
+		int sy = std::min(by * 4 + y, height - 1);
+		for (int x = 0; x < 4; x++)
+		{
+			int sx = std::min(bx * 4 + x, width - 1);
+			const unsigned char *texel = rgba + ((size_t)sy * width + sx) * 4;
+			int i = y * 4 + x;
+			block.r[i] = texel[0];
+			block.g[i] = texel[1];
+			block.b[i] = texel[2];
+			block.a[i] = texel[3];
+		}
+	}
+}
+
+inline void decodeBlock(const unsigned char *in, int format, unsigned char rgba[64])
+{
+	switch (format)
+	{
+	case BLOCK_BC1:
+		decodeColorBlock(in, false, rgba);
+		break;
+	case BLOCK_BC3:
+		decodeBC3(in, rgba);
+		break;
+	default:
+		decodeBC7(in, rgba);
+		break;
+	}
+}
+
+// Compresses an RGBA image into dst (compressedSize bytes). Rows of blocks are shared out to
+// threadCount threads, all cores if 0; with 1 everything runs on the caller's thread, which is
+// what callers on a thread pool of their own want. Returns the squared error over the image's
+// texels, alpha included unless BC1.
+inline double compressImage(const unsigned char *rgba, int width, int height, int format, unsigned char *dst, unsigned int threadCount = 0)
+{
+	int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	threadCount = std::max(1u, std::min(threadCount, (unsigned int)blocksHigh));
+	std::vector<double> errors(threadCount, 0.0);
+	auto compressRows = [=, &errors](unsigned int t)
+	{
+		double error = 0.0;
+		BlockPixels block;
+		unsigned char decoded[64];
+		for (int by = (int)t; by < blocksHigh; by += (int)threadCount)
+		{
+			for (int bx = 0; bx < blocksWide; bx++)
+			{
+				unsigned char *out = dst + ((size_t)by * blocksWide + bx) * blockBytes(format);
+				fetchBlock(rgba, width, height, bx, by, block);
+				if (format == BLOCK_BC1)
+					encodeBC1(block, out);
+				else if (format == BLOCK_BC3)
+					encodeBC3(block, out);
+				else
+					encodeBC7(block, out);
+				// measured against the texels inside the image only
+				decodeBlock(out, format, decoded);
+				for (int y = 0; y < 4 && by * 4 + y < height; y++)
+				{
+					for (int x = 0; x < 4 && bx * 4 + x < width; x++)
+					{
+						int i = y * 4 + x;
+						const float original[4] = { block.r[i], block.g[i], block.b[i], block.a[i] };
+						for (int c = 0; c < (format == BLOCK_BC1 ? 3 : 4); c++)
+						{
+							double difference = original[c] - decoded[4 * i + c];
+							error += difference * difference;
+						}
+					}
+				}
+			}
+		}
+		errors[t] = error;
+	};
+	std::vector<std::thread> threads;
+	for (unsigned int t = 1; t < threadCount; t++)
+		threads.push_back(std::thread(compressRows, t));
+	compressRows(0);
+	double total = errors[0];
+	for (unsigned int t = 1; t < threadCount; t++)
+	{
+		threads[t - 1].join();
+		total += errors[t];
+	}
+	return total;
+}
+
+// Peak signal to noise ratio of a squared error over count samples; 99 dB stands for lossless
+inline double psnr(double squaredError, double count)
+{
+	if (squaredError <= 0.0 || count <= 0.0)
+		return 99.0;
+	return 10.0 * std::log10(255.0 * 255.0 * count / squaredError);
+}
+
+#endif
@@ -0,0 +1,228 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+// Axis aligned bounding box
+struct Bounds
+{
+	glm::vec3 min, max;
+};
+
+// The six planes of a frustum, normals pointing inwards; a point p is inside a plane when
+// dot(normal, p) + distance >= 0
+struct Frustum
+{
+	glm::vec3 normal[6];
+	float distance[6];
+
+	Frustum() {}
+
+	// Planes of the clip volume of a view-projection matrix, perspective or orthographic
+	explicit Frustum(const glm::mat4 &viewProjection)
+	{
+		glm::vec4 rows[4];
+		for (int i = 0; i < 4; i++)
+			rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+		for (int i = 0; i < 6; i++)
+		{
+			glm::vec4 plane = i % 2 == 0 ? rows[3] + rows[i / 2] : rows[3] - rows[i / 2];
+			float length = glm::length(glm::vec3(plane));
+			normal[i] = glm::vec3(plane) / length;
+			distance[i] = plane.w / length;
+		}
+	}
+};
+
+// Bounding volume hierarchy of four children per node. A node keeps the boxes of its children as
+// struct-of-arrays, so one SSE instruction tests four boxes against a frustum plane. Every child
+// also keeps the range of items below it, so a child fully inside the frustum is taken whole.
+// Built once from the item boxes; items that move need a rebuild.
+class BVH
+{
+public:
+	// items in a leaf at most
+	static const int LEAF_SIZE = 4;
+
+	BVH() : visitedNodes(0) {}
+
+	void build(const std::vector<Bounds> &items)
+	{
+		bounds = items;
+		nodes.clear();
+		order.resize(items.size());
+		centers.resize(items.size());
+		for (size_t i = 0; i < items.size(); i++)
+		{
+			order[i] = (unsigned int)i;
+			centers[i] = (items[i].min + items[i].max) * 0.5f;
+		}
+		if (!items.empty())
+			buildNode(0, (int)items.size());
+	}
+
+	int size() const
+	{
+		return (int)bounds.size();
+	}
+
+	// Appends the items whose boxes may be inside the frustum; boxes of a leaf are not tested
+	// one by one, so a few items just outside can be included
+	void cull(const Frustum &frustum, std::vector<unsigned int> &visible)
+	{
+		visitedNodes = 0;
+		if (nodes.empty())
+			return;
+		int stack[64];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			const Node &node = nodes[stack[--top]];
+			visitedNodes++;
+			int outside, inside;
+			classify(node, frustum, outside, inside);
+			for (int c = 0; c < 4; c++)
+			{
+				if (node.count[c] == 0 || (outside & (1 << c)))
+					continue;
+				if ((inside & (1 << c)) || node.child[c] < 0)
+					visible.insert(visible.end(), order.begin() + node.first[c], order.begin() + node.first[c] + node.count[c]);
+				else
+					stack[top++] = node.child[c];
+			}
+		}
+	}
+
+	// Nodes tested by the last cull
+	int visited() const
+	{
+		return visitedNodes;
+	}
+
+	int nodeCount() const
+	{
+		return (int)nodes.size();
+	}
+
+private:
+	// child[c] is the node of child c, or -1 if it is a leaf; count[c] is 0 for no child
+	struct Node
+	{
+		float minX[4], minY[4], minZ[4], maxX[4], maxY[4], maxZ[4];
+		int child[4], first[4], count[4];
+	};
+
+	std::vector<Bounds> bounds;
+	std::vector<glm::vec3> centers;
+	// item ids in tree order; the items below any child are contiguous
+	std::vector<unsigned int> order;
+	std::vector<Node> nodes;
+	int visitedNodes;
+
+	// Sorts the range around its middle along the longest axis of its centers; returns the middle
+	int split(int first, int count)
+	{
+		glm::vec3 low(1e30f), high(-1e30f);
+		for (int i = first; i < first + count; i++)
+		{
+			low = glm::min(low, centers[order[i]]);
+			high = glm::max(high, centers[order[i]]);
+		}
+		glm::vec3 extent = high - low;
+		int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		int middle = first + count / 2;
+		std::nth_element(order.begin() + first, order.begin() + middle, order.begin() + first + count,
+			[this, axis](unsigned int a, unsigned int b) { return centers[a][axis] < centers[b][axis]; });
+		return middle;
+	}
+
+	int buildNode(int first, int count)
+	{
+		int index = (int)nodes.size();
+		nodes.push_back(Node());
+		// halves, then quarters
+		int middle = split(first, count);
+		int lowMiddle = split(first, middle - first);
+		int highMiddle = split(middle, first + count - middle);
+		int starts[5] = { first, lowMiddle, middle, highMiddle, first + count };
+		for (int c = 0; c < 4; c++)
+		{
+			int childFirst = starts[c], childCount = starts[c + 1] - starts[c];
+			glm::vec3 low(1e30f), high(-1e30f);
+			for (int i = childFirst; i < childFirst + childCount; i++)
+			{
+				low = glm::min(low, bounds[order[i]].min);
+				high = glm::max(high, bounds[order[i]].max);
+			}
+			// nodes may move while children are built
+			int child = childCount > LEAF_SIZE ? buildNode(childFirst, childCount) : -1;
+			Node &node = nodes[index];
+			node.minX[c] = low.x;
+			node.minY[c] = low.y;
+			node.minZ[c] = low.z;
+			node.maxX[c] = high.x;
+			node.maxY[c] = high.y;
+			node.maxZ[c] = high.z;
+			node.child[c] = child;
+			node.first[c] = childFirst;
+			node.count[c] = childCount;
+		}
+		return index;
+	}
+
+	// Bit c of outside is set when child c is outside a plane, bit c of inside when it is inside all.
+	// Per plane, the box corner farthest along the normal decides outside, the nearest one inside.
+	static void classify(const Node &node, const Frustum &frustum, int &outside, int &inside)
+	{
+#ifdef BVH_USE_SSE
+		__m128 out = _mm_setzero_ps();
+		__m128 in = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		__m128 minX = _mm_loadu_ps(node.minX), minY = _mm_loadu_ps(node.minY), minZ = _mm_loadu_ps(node.minZ);
+		__m128 maxX = _mm_loadu_ps(node.maxX), maxY = _mm_loadu_ps(node.maxY), maxZ = _mm_loadu_ps(node.maxZ);
+		__m128 zero = _mm_setzero_ps();
+		for (int p = 0; p < 6; p++)
+		{
+			const glm::vec3 &n = frustum.normal[p];
+			__m128 nx = _mm_set1_ps(n.x), ny = _mm_set1_ps(n.y), nz = _mm_set1_ps(n.z), d = _mm_set1_ps(frustum.distance[p]);
+			__m128 farDistance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, n.x >= 0.0f ? maxX : minX), _mm_mul_ps(ny, n.y >= 0.0f ? maxY : minY)),
+				_mm_add_ps(_mm_mul_ps(nz, n.z >= 0.0f ? maxZ : minZ), d));
+			__m128 nearDistance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, n.x >= 0.0f ? minX : maxX), _mm_mul_ps(ny, n.y >= 0.0f ? minY : maxY)),
+				_mm_add_ps(_mm_mul_ps(nz, n.z >= 0.0f ? minZ : maxZ), d));
+			out = _mm_or_ps(out, _mm_cmplt_ps(farDistance, zero));
+			in = _mm_and_ps(in, _mm_cmpge_ps(nearDistance, zero));
+		}
+		outside = _mm_movemask_ps(out);
+		inside = _mm_movemask_ps(in);
+#else
+		outside = 0;
+		inside = 15;
+		for (int c = 0; c < 4; c++)
+		{
+			for (int p = 0; p < 6; p++)
+			{
+				const glm::vec3 &n = frustum.normal[p];
+				float farDistance = n.x * (n.x >= 0.0f ? node.maxX[c] : node.minX[c]) + n.y * (n.y >= 0.0f ? node.maxY[c] : node.minY[c])
+					+ n.z * (n.z >= 0.0f ? node.maxZ[c] : node.minZ[c]) + frustum.distance[p];
+				float nearDistance = n.x * (n.x >= 0.0f ? node.minX[c] : node.maxX[c]) + n.y * (n.y >= 0.0f ? node.minY[c] : node.maxY[c])
+					+ n.z * (n.z >= 0.0f ? node.minZ[c] : node.maxZ[c]) + frustum.distance[p];
+				if (farDistance < 0.0f)
+					outside |= 1 << c;
+				if (nearDistance < 0.0f)
+					inside &= ~(1 << c);
+			}
+		}
+#endif
+	}
+};
+
+#endif
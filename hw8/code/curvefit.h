@@ -0,0 +1,193 @@
+#ifndef CURVEFIT_H
+#define CURVEFIT_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+
+// Least-squares fitting of a chain of cubic Bezier segments to digitized points
+// (Schneider, "An Algorithm for Automatically Fitting Digitized Curves", Graphics Gems 1990).
+// Each segment is fitted with fixed end tangents; if the error is close to the tolerance the
+// parameters are refined with Newton-Raphson, otherwise the points are split at the worst fit.
+// The result is a control point chain p0 c1 c2 p1 c1 c2 p2 ..., i.e. 3 * segments + 1 points.
+class CurveFitter
+{
+public:
+	static std::vector<glm::vec2> fit(const std::vector<glm::vec2> &input, float tolerance)
+	{
+		std::vector<glm::vec2> chain;
+		// repeated samples make the tangents and the chord-length parameters degenerate
+		std::vector<glm::vec2> points;
+		points.reserve(input.size());
+		for (size_t i = 0; i < input.size(); i++)
+		{
+			if (points.empty() || glm::distance(points.back(), input[i]) > 1e-5f)
+				points.push_back(input[i]);
+		}
+		if (points.size() < 2)
+			return chain;
+
+		int last = (int)points.size() - 1;
+		glm::vec2 tangent1 = direction(points[1] - points[0]);
+		glm::vec2 tangent2 = direction(points[last - 1] - points[last]);
+		chain.push_back(points[0]);
+		fitCubic(points, 0, last, tangent1, tangent2, tolerance * tolerance, chain);
+		return chain;
+	}
+
+private:
+	static const int MAX_ITERATIONS = 4;
+
+	static glm::vec2 direction(glm::vec2 v)
+	{
+		float length = glm::length(v);
+		return length > 1e-12f ? v / length : glm::vec2(0.0f);
+	}
+
+	static glm::vec2 cubic(const glm::vec2 *bez, float t)
+	{
+		float s = 1.0f - t;
+		return bez[0] * (s * s * s) + bez[1] * (3 * s * s * t) + bez[2] * (3 * s * t * t) + bez[3] * (t * t * t);
+	}
+
+	static void fitCubic(const std::vector<glm::vec2> &d, int first, int last, glm::vec2 tangent1, glm::vec2 tangent2,
+		float squaredError, std::vector<glm::vec2> &chain)
+	{
+		glm::vec2 bez[4];
+		if (last - first == 1)
+		{
+			float dist = glm::distance(d[first], d[last]) / 3.0f;
+			bez[0] = d[first];
+			bez[3] = d[last];
+			bez[1] = bez[0] + tangent1 * dist;
+			bez[2] = bez[3] + tangent2 * dist;
+			emit(bez, chain);
+			return;
+		}
+
+		std::vector<float> u = chordLengthParameterize(d, first, last);
+		generateBezier(d, first, last, u, tangent1, tangent2, bez);
+		int splitPoint;
+		float maxError = computeMaxError(d, first, last, bez, u, splitPoint);
+		if (maxError < squaredError)
+		{
+			emit(bez, chain);
+			return;
+		}
+
+		// close enough to be worth re-parameterizing before splitting
+		if (maxError < squaredError * 16.0f)
+		{
+			for (int i = 0; i < MAX_ITERATIONS; i++)
+			{
+				reparameterize(d, first, last, u, bez);
+				generateBezier(d, first, last, u, tangent1, tangent2, bez);
+				maxError = computeMaxError(d, first, last, bez, u, splitPoint);
+				if (maxError < squaredError)
+				{
+					emit(bez, chain);
+					return;
+				}
+			}
+		}
+
+		glm::vec2 center = direction(d[splitPoint - 1] - d[splitPoint + 1]);
+		fitCubic(d, first, splitPoint, tangent1, center, squaredError, chain);
+		fitCubic(d, splitPoint, last, -center, tangent2, squaredError, chain);
+	}
+
+	static void emit(const glm::vec2 *bez, std::vector<glm::vec2> &chain)
+	{
+		chain.push_back(bez[1]);
+		chain.push_back(bez[2]);
+		chain.push_back(bez[3]);
+	}
+
+	static std::vector<float> chordLengthParameterize(const std::vector<glm::vec2> &d, int first, int last)
+	{
+		std::vector<float> u(last - first + 1);
+		u[0] = 0.0f;
+		for (int i = first + 1; i <= last; i++)
+			u[i - first] = u[i - first - 1] + glm::distance(d[i], d[i - 1]);
+		for (int i = first + 1; i <= last; i++)
+			u[i - first] /= u[last - first];
+		return u;
+	}
+
+	// Least-squares placement of the two inner control points along the fixed end tangents
+	static void generateBezier(const std::vector<glm::vec2> &d, int first, int last, const std::vector<float> &u,
+		glm::vec2 tangent1, glm::vec2 tangent2, glm::vec2 *bez)
+	{
+		float c00 = 0, c01 = 0, c11 = 0, x0 = 0, x1 = 0;
+		glm::vec2 p0 = d[first], p3 = d[last];
+		for (int i = first; i <= last; i++)
+		{
+			float t = u[i - first], s = 1.0f - t;
+			float b0 = s * s * s, b1 = 3 * s * s * t, b2 = 3 * s * t * t, b3 = t * t * t;
+			glm::vec2 a1 = tangent1 * b1;
+			glm::vec2 a2 = tangent2 * b2;
+			c00 += glm::dot(a1, a1);
+			c01 += glm::dot(a1, a2);
+			c11 += glm::dot(a2, a2);
+			glm::vec2 tmp = d[i] - (p0 * (b0 + b1) + p3 * (b2 + b3));
+			x0 += glm::dot(a1, tmp);
+			x1 += glm::dot(a2, tmp);
+		}
+		float detC = c00 * c11 - c01 * c01;
+		float alpha1 = detC == 0.0f ? 0.0f : (x0 * c11 - x1 * c01) / detC;
+		float alpha2 = detC == 0.0f ? 0.0f : (c00 * x1 - c01 * x0) / detC;
+
+		// fall back to the Wu/Barsky heuristic when the solution is degenerate
+		float segLength = glm::distance(p0, p3);
+		float epsilon = 1e-6f * segLength;
+		if (alpha1 < epsilon || alpha2 < epsilon)
+			alpha1 = alpha2 = segLength / 3.0f;
+
+		bez[0] = p0;
+		bez[3] = p3;
+		bez[1] = p0 + tangent1 * alpha1;
+		bez[2] = p3 + tangent2 * alpha2;
+	}
+
+	// One Newton-Raphson step of every parameter towards the closest point on the curve
+	static void reparameterize(const std::vector<glm::vec2> &d, int first, int last, std::vector<float> &u, const glm::vec2 *bez)
+	{
+		glm::vec2 q1[3], q2[2];
+		for (int i = 0; i < 3; i++)
+			q1[i] = (bez[i + 1] - bez[i]) * 3.0f;
+		for (int i = 0; i < 2; i++)
+			q2[i] = (q1[i + 1] - q1[i]) * 2.0f;
+		for (int i = first; i <= last; i++)
+		{
+			float t = u[i - first], s = 1.0f - t;
+			glm::vec2 diff = cubic(bez, t) - d[i];
+			glm::vec2 d1 = q1[0] * (s * s) + q1[1] * (2 * s * t) + q1[2] * (t * t);
+			glm::vec2 d2 = q2[0] * s + q2[1] * t;
+			float numerator = glm::dot(diff, d1);
+			float denominator = glm::dot(d1, d1) + glm::dot(diff, d2);
+			if (denominator != 0.0f)
+				u[i - first] = t - numerator / denominator;
+		}
+	}
+
+	static float computeMaxError(const std::vector<glm::vec2> &d, int first, int last, const glm::vec2 *bez,
+		const std::vector<float> &u, int &splitPoint)
+	{
+		float maxDist = 0.0f;
+		splitPoint = (last - first + 1) / 2 + first;
+		for (int i = first + 1; i < last; i++)
+		{
+			glm::vec2 v = cubic(bez, u[i - first]) - d[i];
+			float dist = glm::dot(v, v);
+			if (dist >= maxDist)
+			{
+				maxDist = dist;
+				splitPoint = i;
+			}
+		}
+		return maxDist;
+	}
+};
+
+#endif
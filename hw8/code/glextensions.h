@@ -0,0 +1,135 @@
+#ifndef GLEXTENSIONS_H
+#define GLEXTENSIONS_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+
+// Entry points and tokens newer than the GL 3.3 core profile glad was generated for.
+// They are loaded at run time and must only be called when the matching flag is set.
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_VERTEX_SHADER_INVOCATIONS
+#define GL_VERTEX_SHADER_INVOCATIONS 0x82F0
+#endif
+#ifndef GL_ANY_SAMPLES_PASSED_CONSERVATIVE
+#define GL_ANY_SAMPLES_PASSED_CONSERVATIVE 0x8D6A
+#endif
+
+typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+typedef void (APIENTRYP TexStorage2DProc)(GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
+typedef void (APIENTRYP MultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void *indirect, GLsizei drawcount, GLsizei stride);
+
+struct GLExtensions
+{
+	// GL 4.1 / ARB_get_program_binary, usable only if the driver offers at least one binary format
+	bool programBinary;
+	GetProgramBinaryProc getProgramBinary;
+	ProgramBinaryProc loadProgramBinary;
+	ProgramParameteriProc programParameteri;
+	// KHR/ARB_parallel_shader_compile: compiles run on driver threads, GL_COMPLETION_STATUS_KHR polls them
+	bool parallelShaderCompile;
+	MaxShaderCompilerThreadsProc maxShaderCompilerThreads;
+	// GL 4.2 / ARB_texture_storage: immutable texture storage allocated in one call
+	bool textureStorage;
+	TexStorage2DProc texStorage2D;
+	// EXT_texture_compression_s3tc (BC1/BC3) and GL 4.2 / ARB_texture_compression_bptc (BC7);
+	// the upload calls are core, only the formats are extensions
+	bool s3tc, bptc;
+	// GL 4.3 / ARB_multi_draw_indirect with ARB_base_instance: many indexed draws from a buffer in one call
+	bool multiDrawIndirect;
+	MultiDrawElementsIndirectProc multiDrawElementsIndirect;
+	// GL 4.3 / ARB_ES3_compatibility: occlusion queries that may answer early and err towards visible
+	bool conservativeOcclusion;
+	// GL 4.6 / ARB_pipeline_statistics_query: queries that count shader invocations
+	bool pipelineStatistics;
+
+	GLExtensions()
+	{
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count; i++)
+			names.push_back((const char *)glGetStringi(GL_EXTENSIONS, i));
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		version = major * 10 + minor;
+
+		getProgramBinary = (GetProgramBinaryProc)glfwGetProcAddress("glGetProgramBinary");
+		loadProgramBinary = (ProgramBinaryProc)glfwGetProcAddress("glProgramBinary");
+		programParameteri = (ProgramParameteriProc)glfwGetProcAddress("glProgramParameteri");
+		GLint formats = 0;
+		if (version >= 41 || has("GL_ARB_get_program_binary"))
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		programBinary = formats > 0 && getProgramBinary != NULL && loadProgramBinary != NULL && programParameteri != NULL;
+
+		maxShaderCompilerThreads = NULL;
+		if (has("GL_KHR_parallel_shader_compile"))
+			maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+		else if (has("GL_ARB_parallel_shader_compile"))
+			maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+		parallelShaderCompile = maxShaderCompilerThreads != NULL;
+
+		texStorage2D = (TexStorage2DProc)glfwGetProcAddress("glTexStorage2D");
+		textureStorage = (version >= 42 || has("GL_ARB_texture_storage")) && texStorage2D != NULL;
+
+		s3tc = has("GL_EXT_texture_compression_s3tc");
+		bptc = version >= 42 || has("GL_ARB_texture_compression_bptc");
+
+		multiDrawElementsIndirect = (MultiDrawElementsIndirectProc)glfwGetProcAddress("glMultiDrawElementsIndirect");
+		multiDrawIndirect = (version >= 43 || (has("GL_ARB_multi_draw_indirect") && has("GL_ARB_base_instance"))) && multiDrawElementsIndirect != NULL;
+
+		conservativeOcclusion = version >= 43 || has("GL_ARB_ES3_compatibility");
+		pipelineStatistics = version >= 46 || has("GL_ARB_pipeline_statistics_query");
+	}
+
+	bool has(const char *name) const
+	{
+		for (size_t i = 0; i < names.size(); i++)
+		{
+			if (names[i] == name)
+				return true;
+		}
+		return false;
+	}
+
+private:
+	std::vector<std::string> names;
+	int version;
+};
+
+// Queried once, the first time it is needed with the context current
+inline const GLExtensions &glExtensions()
+{
+	static GLExtensions extensions;
+	return extensions;
+}
+
+#endif
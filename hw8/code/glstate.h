@@ -0,0 +1,174 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <glad/glad.h>
+
+// Shadows the GL bindings the render paths touch and drops calls that would not change them.
+// All program, VAO, array buffer, capability and texture changes must go through it, otherwise
+// the shadow goes stale; invalidate() forgets everything, e.g. after code that bypasses it.
+class GLStateCache
+{
+public:
+	static const int MAX_TEXTURE_UNITS = 16;
+
+	GLStateCache() : issued(0), filtered(0), lastIssued(0), lastFiltered(0)
+	{
+		invalidate();
+	}
+
+	void invalidate()
+	{
+		program = vertexArray = arrayBuffer = UNKNOWN;
+		activeUnit = UNKNOWN;
+		depthTest = blend = cullFace = -1;
+		for (int i = 0; i < MAX_TEXTURE_UNITS; i++)
+			textures[i] = UNKNOWN;
+	}
+
+	// Starts counting a new frame; the shadow is dropped since other code (ImGui) ran in between
+	void beginFrame()
+	{
+		lastIssued = issued;
+		lastFiltered = filtered;
+		issued = filtered = 0;
+		invalidate();
+	}
+
+	void useProgram(GLuint id)
+	{
+		if (changed(program, id))
+			glUseProgram(id);
+	}
+
+	void bindVertexArray(GLuint id)
+	{
+		if (changed(vertexArray, id))
+			glBindVertexArray(id);
+	}
+
+	// The element array binding belongs to the bound VAO, so only GL_ARRAY_BUFFER is shadowed
+	void bindBuffer(GLenum target, GLuint id)
+	{
+		if (target != GL_ARRAY_BUFFER)
+		{
+			issued++;
+			glBindBuffer(target, id);
+		}
+		else if (changed(arrayBuffer, id))
+		{
+			glBindBuffer(target, id);
+		}
+	}
+
+	void enable(GLenum cap)
+	{
+		setCapability(cap, true);
+	}
+
+	void disable(GLenum cap)
+	{
+		setCapability(cap, false);
+	}
+
+	// Whether a capability is on; asks GL only while the shadow does not know, then remembers it
+	bool isEnabled(GLenum cap)
+	{
+		int *state = capability(cap);
+		if (state != NULL && *state != -1)
+		{
+			filtered++;
+			return *state != 0;
+		}
+		issued++;
+		bool on = glIsEnabled(cap) == GL_TRUE;
+		if (state != NULL)
+			*state = (int)on;
+		return on;
+	}
+
+	void activeTexture(GLenum unit)
+	{
+		if (changed(activeUnit, unit))
+			glActiveTexture(unit);
+	}
+
+	// Only 2D textures on the first MAX_TEXTURE_UNITS units are shadowed
+	void bindTexture(GLenum target, GLuint id)
+	{
+		int unit = activeUnit == UNKNOWN ? -1 : (int)(activeUnit - GL_TEXTURE0);
+		if (target != GL_TEXTURE_2D || unit < 0 || unit >= MAX_TEXTURE_UNITS)
+		{
+			issued++;
+			glBindTexture(target, id);
+		}
+		else if (changed(textures[unit], id))
+		{
+			glBindTexture(target, id);
+		}
+	}
+
+	// Call counts of the last complete frame
+	int issuedCalls() const
+	{
+		return lastIssued;
+	}
+
+	int filteredCalls() const
+	{
+		return lastFiltered;
+	}
+
+private:
+	static const GLuint UNKNOWN = 0xffffffffu;
+
+	GLuint program, vertexArray, arrayBuffer;
+	GLuint activeUnit;
+	GLuint textures[MAX_TEXTURE_UNITS];
+	int depthTest, blend, cullFace;
+	int issued, filtered;
+	int lastIssued, lastFiltered;
+
+	bool changed(GLuint &current, GLuint value)
+	{
+		if (current == value)
+		{
+			filtered++;
+			return false;
+		}
+		current = value;
+		issued++;
+		return true;
+	}
+
+	// The shadow of a capability, NULL for those not shadowed
+	int *capability(GLenum cap)
+	{
+		return cap == GL_DEPTH_TEST ? &depthTest : cap == GL_BLEND ? &blend : cap == GL_CULL_FACE ? &cullFace : NULL;
+	}
+
+	void setCapability(GLenum cap, bool on)
+	{
+		int *state = capability(cap);
+		if (state != NULL && *state == (int)on)
+		{
+			filtered++;
+			return;
+		}
+		if (state != NULL)
+			*state = (int)on;
+		issued++;
+		if (on)
+			glEnable(cap);
+		else
+			glDisable(cap);
+	}
+};
+
+// The cache of the one GL context
+inline GLStateCache &glState()
+{
+	static GLStateCache cache;
+	return cache;
+}
+
+#endif
@@ -7,23 +7,46 @@
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 800;
 
-unsigned int load_hw2();
-void render_hw2(unsigned int);
-
-unsigned int load_hw3();
-void render_hw3(unsigned int);
-
-unsigned int load_hw4();
-void render_hw4(unsigned int);
-
-unsigned int load_hw5();
-void render_hw5(unsigned int, GLFWwindow *);
-
+// Lifecycle hooks of the modules, registered with the module registry in main.
+// init_hwN loads a step at a time and returns true once render_hwN can be called;
+// shutdown_hwN frees every GPU resource and gpuBytes_hwN reports what is held.
+bool init_hw2();
+void render_hw2();
+void shutdown_hw2();
+GLsizeiptr gpuBytes_hw2();
+
+bool init_hw3();
+void render_hw3();
+void shutdown_hw3();
+GLsizeiptr gpuBytes_hw3();
+
+bool init_hw4();
+void render_hw4();
+void shutdown_hw4();
+GLsizeiptr gpuBytes_hw4();
+
+bool init_hw5();
+void update_hw5(GLFWwindow *);
+void render_hw5();
+void shutdown_hw5();
+GLsizeiptr gpuBytes_hw5();
+
+bool init_hw6();
 void render_hw6();
+void shutdown_hw6();
+GLsizeiptr gpuBytes_hw6();
 
+bool init_hw7();
 void render_hw7();
+void shutdown_hw7();
+GLsizeiptr gpuBytes_hw7();
 
+bool init_hw8();
+void update_hw8(GLFWwindow *);
 void render_hw8();
+void shutdown_hw8();
+GLsizeiptr gpuBytes_hw8();
 void mousebutton_callback(GLFWwindow*, int, int, int);
+void cursorpos_callback(GLFWwindow*, double, double);
 
 #endif
\ No newline at end of file
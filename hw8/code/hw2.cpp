@@ -6,10 +6,17 @@
 #include "imgui_impl_opengl3.h"
 
 #include "hw.h"
+#include "shader.h"
+#include "mesh.h"
 
 #include <iostream>
 
-unsigned int load_hw2()
+// compiled in the background by init_hw2; the mesh is made on first render.
+// Both are freed by shutdown_hw2
+static Shader *shader;
+static MeshHandle mesh;
+
+bool init_hw2()
 {
 	const char *vertexShaderSource = "#version 330 core\n"
 		"layout (location = 0) in vec3 aPos;\n"
@@ -29,54 +36,15 @@ unsigned int load_hw2()
 		"   FragColor = vec4(ourColor, 1.0f);\n"
 		"}\n\0";
 
-	int success;
-	char infoLog[512];
-	//create and compile vertex shader
-	unsigned int vertexShader;
-	vertexShader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-	glCompileShader(vertexShader);
-	// check for shader compile errors
-	glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-	if (!success)
-	{
-		glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-		std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-	}
-
-	//create and compile fragment shader
-	unsigned int fragmentShader;
-	fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-	glCompileShader(fragmentShader);
-	// check for shader compile errors
-	glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-	if (!success)
-	{
-		glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-		std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-	}
-
-	// link shaders
-	unsigned int shaderProgram;
-	shaderProgram = glCreateProgram();
-	glAttachShader(shaderProgram, vertexShader);
-	glAttachShader(shaderProgram, fragmentShader);
-	glLinkProgram(shaderProgram);
-	// check for linking errors
-	glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-	if (!success) {
-		glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-		std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-	}
-	glDeleteShader(vertexShader);
-	glDeleteShader(fragmentShader);
-
-	return shaderProgram;
+	// linked in the background, or loaded from the program cache
+	if (shader == NULL)
+		shader = new Shader(vertexShaderSource, fragmentShaderSource, nullptr, true);
+	return shader->ready();
 }
 
-void render_hw2(unsigned int shaderProgram)
+void render_hw2()
 {
+	unsigned int shaderProgram = shader->ID;
 	// set up vertex data (and buffer(s)) and configure vertex attributes
 	// ------------------------------------------------------------------
 	static float vertices[] = {
@@ -105,14 +73,9 @@ void render_hw2(unsigned int shaderProgram)
 
 	static ImVec4 color = ImVec4(1.0f, 1.0f, 1.0f, 1.00f);
 
-	unsigned int VAO;
-	glGenVertexArrays(1, &VAO);
-
-	unsigned int VBO;
-	glGenBuffers(1, &VBO);
-
-	unsigned int EBO;
-	glGenBuffers(1, &EBO);
+	// uploaded once; position and color attributes
+	if (mesh == 0)
+		mesh = meshRegistry().create(vertices, sizeof(vertices), indices, sizeof(indices), 6, { { 0, 3, 0 }, { 1, 3, 3 } });
 
 	// render loop
 	// -----------
@@ -128,6 +91,7 @@ void render_hw2(unsigned int shaderProgram)
 				vertices[i * 6 + 4] = color.y;
 				vertices[i * 6 + 5] = color.z;
 			}
+			meshRegistry().update(mesh, vertices, sizeof(vertices));
 		}
 
 		ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
@@ -137,33 +101,25 @@ void render_hw2(unsigned int shaderProgram)
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT);
 
-	glUseProgram(shaderProgram);
-	glBindVertexArray(VAO);
-	//VBO
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-	//EBO
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-	//position
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	//color
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
+	glState().useProgram(shaderProgram);
+	meshRegistry().get(mesh).bind();
 
 	//glDrawArrays(GL_TRIANGLES, 0, 3);
 	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 	glDrawArrays(GL_LINES, 4, 2);
 	glDrawArrays(GL_POINTS, 6, 6);
+}
 
-	//unbind
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
+void shutdown_hw2()
+{
+	delete shader;
+	shader = NULL;
+	if (mesh != 0)
+		meshRegistry().release(mesh);
+	mesh = 0;
+}
 
-	//delete
-	glDeleteVertexArrays(1, &VAO);
-	glDeleteBuffers(1, &VBO);
-	glDeleteBuffers(1, &EBO);
+GLsizeiptr gpuBytes_hw2()
+{
+	return meshRegistry().gpuBytes(mesh);
 }
@@ -6,11 +6,18 @@
 #include "imgui_impl_opengl3.h"
 
 #include "hw.h"
+#include "shader.h"
+#include "streambuffer.h"
 
 #include <iostream>
 #include <algorithm>
 
-unsigned int load_hw3()
+// compiled in the background by init_hw3; the layout is made on first render.
+// Both are freed by shutdown_hw3
+static Shader *shader;
+static GLuint pixelLayout;
+
+bool init_hw3()
 {
 	const char *vertexShaderSource = "#version 330 core\n"
 		"layout (location = 0) in vec2 aPos;\n"
@@ -26,50 +33,10 @@ unsigned int load_hw3()
 		"   FragColor = vec4(1.0f, 1.0f, 1.0f, 1.0f);\n"
 		"}\n\0";
 
-	int success;
-	char infoLog[512];
-	//create and compile vertex shader
-	unsigned int vertexShader;
-	vertexShader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-	glCompileShader(vertexShader);
-	// check for shader compile errors
-	glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-	if (!success)
-	{
-		glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-		std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-	}
-
-	//create and compile fragment shader
-	unsigned int fragmentShader;
-	fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-	glCompileShader(fragmentShader);
-	// check for shader compile errors
-	glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-	if (!success)
-	{
-		glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-		std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-	}
-
-	// link shaders
-	unsigned int shaderProgram;
-	shaderProgram = glCreateProgram();
-	glAttachShader(shaderProgram, vertexShader);
-	glAttachShader(shaderProgram, fragmentShader);
-	glLinkProgram(shaderProgram);
-	// check for linking errors
-	glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-	if (!success) {
-		glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-		std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-	}
-	glDeleteShader(vertexShader);
-	glDeleteShader(fragmentShader);
-
-	return shaderProgram;
+	// linked in the background, or loaded from the program cache
+	if (shader == NULL)
+		shader = new Shader(vertexShaderSource, fragmentShaderSource, nullptr, true);
+	return shader->ready();
 }
 
 float normalize(int i)
@@ -226,8 +193,9 @@ int rasterize_triangle(float vertices[], int v[3][2], int size)
 	return size;
 }
 
-void render_hw3(unsigned int shaderProgram)
+void render_hw3()
 {
+	unsigned int shaderProgram = shader->ID;
 	// set up vertex data (and buffer(s)) and configure vertex attributes
 	// ------------------------------------------------------------------
 	static float vertices[2 * 40000];
@@ -240,11 +208,9 @@ void render_hw3(unsigned int shaderProgram)
 
 	int size = 0;
 
-	unsigned int VAO;
-	glGenVertexArrays(1, &VAO);
-
-	unsigned int VBO;
-	glGenBuffers(1, &VBO);
+	// rasterized pixels change every frame and are streamed
+	if (pixelLayout == 0)
+		pixelLayout = streamBuffer().createLayout(2, { { 0, 2, 0 } });
 
 	// render loop
 	// -----------
@@ -276,23 +242,23 @@ void render_hw3(unsigned int shaderProgram)
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT);
 
-	glUseProgram(shaderProgram);
-	glBindVertexArray(VAO);
-	//VBO
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, size * sizeof(float), vertices, GL_DYNAMIC_DRAW);
-
-	//position
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-
-	glDrawArrays(GL_POINTS, 0, size / 2);
+	glState().useProgram(shaderProgram);
+	GLint first = streamBuffer().upload(vertices, size * sizeof(float), 2);
+	glState().bindVertexArray(pixelLayout);
+	glDrawArrays(GL_POINTS, first, size / 2);
+}
 
-	//unbind
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
+void shutdown_hw3()
+{
+	glDeleteVertexArrays(1, &pixelLayout);
+	pixelLayout = 0;
+	// deleting the program also resets the state cache, which may still hold the layout
+	delete shader;
+	shader = NULL;
+}
 
-	//delete
-	glDeleteVertexArrays(1, &VAO);
-	glDeleteBuffers(1, &VBO);
+// the pixels live in the shared stream buffer
+GLsizeiptr gpuBytes_hw3()
+{
+	return 0;
 }
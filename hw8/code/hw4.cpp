@@ -9,20 +9,127 @@
 #include "imgui_impl_opengl3.h"
 
 #include "hw.h"
+#include "shader.h"
+#include "mesh.h"
+#include "looseoctree.h"
+#include "profiler.h"
 
 #include <iostream>
 #include <algorithm>
+#include <vector>
+#include <cmath>
 
-unsigned int load_hw4()
+// compiled in the background by init_hw4; the mesh is made on first render.
+// Both are freed by shutdown_hw4
+static Shader *shader;
+static MeshHandle cube;
+static Uniform<glm::mat4> transform;
+// the crowd: up to MAX_CROWD cubes running the Mix animation, each at its own phase. They move
+// every frame, so they are kept in a loose octree, which is queried for culling and picking
+static LooseOctree crowdTree(glm::vec3(0.0f), 16.0f);
+static std::vector<unsigned int> crowdIds;
+static const int MAX_CROWD = 10000;
+// shader location of the per-instance matrix, which takes four locations
+static const GLuint INSTANCE_LOCATION = 2;
+
+// The Mix animation at time t
+static glm::mat4 mixTransform(float t)
+{
+	glm::mat4 trans(1.0f);
+	float range = sin(t / 10) / 2;
+	trans = glm::translate(trans, glm::vec3(cos(t)*range, sin(t)* range, 0));
+	trans = glm::rotate(trans, t, glm::vec3(1.0f, 0.0f, 1.0f));
+	float section = abs(sin(t)) / 4 + 0.2;
+	trans = glm::scale(trans, glm::vec3(section, section, section));
+	return trans;
+}
+
+// Animates count cubes on a grid, draws the ones in view and returns the one under a click, or
+// picked unchanged if there was no click
+static int renderCrowd(int count, float time, int picked)
+{
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, -8.0f, 24.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 viewProjection = projection * view;
+
+	int side = (int)std::ceil(std::sqrt((float)count));
+	float spacing = 24.0f / side;
+	std::vector<glm::mat4> models(count);
+	std::vector<Bounds> bounds(count);
+	{
+		ProfileScope scope("hw4 animate");
+		for (int i = 0; i < count; i++)
+		{
+			glm::vec3 base(((i % side) - side * 0.5f + 0.5f) * spacing, ((i / side) - side * 0.5f + 0.5f) * spacing, 0.0f);
+			models[i] = glm::scale(glm::translate(glm::mat4(1.0f), base), glm::vec3(spacing)) * mixTransform(time + i * 0.37f);
+			// a sphere around the cube, so the box holds it at any rotation
+			float radius = 0.5f * std::sqrt(3.0f) * glm::length(glm::vec3(models[i][0]));
+			glm::vec3 center(models[i][3]);
+			bounds[i].min = center - radius;
+			bounds[i].max = center + radius;
+		}
+	}
+	{
+		ProfileScope scope("octree update");
+		while ((int)crowdIds.size() > count)
+		{
+			crowdTree.remove(crowdIds.back());
+			crowdIds.pop_back();
+		}
+		for (int i = 0; i < (int)crowdIds.size(); i++)
+			crowdTree.move(crowdIds[i], bounds[i]);
+		while ((int)crowdIds.size() < count)
+			crowdIds.push_back(crowdTree.insert(bounds[crowdIds.size()]));
+	}
+	// ids are handed out in order and reused from the back, so id i is cube i
+	std::vector<unsigned int> visible;
+	{
+		ProfileScope scope("octree cull");
+		crowdTree.cull(Frustum(viewProjection), visible);
+	}
+	if (ImGui::IsMouseClicked(0) && !ImGui::GetIO().WantCaptureMouse)
+	{
+		ProfileScope scope("octree pick");
+		ImVec2 mouse = ImGui::GetIO().MousePos;
+		glm::vec2 ndc(2.0f * mouse.x / SCR_WIDTH - 1.0f, 1.0f - 2.0f * mouse.y / SCR_HEIGHT);
+		glm::mat4 inverse = glm::inverse(viewProjection);
+		glm::vec4 nearPoint = inverse * glm::vec4(ndc, -1.0f, 1.0f), farPoint = inverse * glm::vec4(ndc, 1.0f, 1.0f);
+		glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+		float distance;
+		picked = crowdTree.pick(origin, glm::normalize(glm::vec3(farPoint) / farPoint.w - origin), distance);
+	}
+
+	std::vector<glm::mat4> drawn(visible.size());
+	for (size_t i = 0; i < visible.size(); i++)
+		drawn[i] = models[visible[i]];
+	transform.set(viewProjection);
+	if (!drawn.empty())
+	{
+		meshRegistry().setInstances(cube, glm::value_ptr(drawn[0]), (GLsizei)drawn.size(), INSTANCE_LOCATION);
+		meshRegistry().get(cube).drawInstanced();
+	}
+	return picked;
+}
+
+// The single cube is one instance with no transform of its own. Uploaded with the cube and again
+// when the crowd, which fills the instances with its own, is turned off.
+static void setSingleInstance()
+{
+	glm::mat4 identity(1.0f);
+	meshRegistry().setInstances(cube, glm::value_ptr(identity), 1, INSTANCE_LOCATION);
+}
+
+bool init_hw4()
 {
 	const char *vertexShaderSource = "#version 330 core\n"
 		"layout (location = 0) in vec3 aPos;\n"
 		"layout (location = 1) in vec3 aColor;\n"
+		"layout (location = 2) in mat4 instance;\n"
 		"uniform mat4 transform;\n"
 		"out vec3 ourColor;\n"
 		"void main()\n"
 		"{\n"
-		"   gl_Position = transform * vec4(aPos, 1.0f);\n"
+		"   gl_Position = transform * instance * vec4(aPos, 1.0f);\n"
 		"   ourColor = aColor;\n"
 		"}\0";
 
@@ -34,54 +141,19 @@ unsigned int load_hw4()
 		"   FragColor = vec4(ourColor, 1.0f);\n"
 		"}\n\0";
 
-	int success;
-	char infoLog[512];
-	//create and compile vertex shader
-	unsigned int vertexShader;
-	vertexShader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-	glCompileShader(vertexShader);
-	// check for shader compile errors
-	glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-	if (!success)
-	{
-		glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-		std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-	}
-
-	//create and compile fragment shader
-	unsigned int fragmentShader;
-	fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-	glCompileShader(fragmentShader);
-	// check for shader compile errors
-	glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-	if (!success)
-	{
-		glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-		std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-	}
-
-	// link shaders
-	unsigned int shaderProgram;
-	shaderProgram = glCreateProgram();
-	glAttachShader(shaderProgram, vertexShader);
-	glAttachShader(shaderProgram, fragmentShader);
-	glLinkProgram(shaderProgram);
-	// check for linking errors
-	glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-	if (!success) {
-		glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-		std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-	}
-	glDeleteShader(vertexShader);
-	glDeleteShader(fragmentShader);
-
-	return shaderProgram;
+	// linked in the background, or loaded from the program cache
+	if (shader == NULL)
+		shader = new Shader(vertexShaderSource, fragmentShaderSource, nullptr, true);
+	if (!shader->ready())
+		return false;
+	// looked up once per program, again if it is rebuilt after a shutdown
+	transform = shader->uniform<glm::mat4>("transform");
+	return true;
 }
 
-void render_hw4(unsigned int shaderProgram)
+void render_hw4()
 {
+	unsigned int shaderProgram = shader->ID;
 	// set up vertex data (and buffer(s)) and configure vertex attributes
 	// ------------------------------------------------------------------
 	static float vertices[] = {
@@ -116,20 +188,18 @@ void render_hw4(unsigned int shaderProgram)
 		5, 7, 3
 	};
 
-	static bool translate, rotate, scale, mix;
+	static bool translate, rotate, scale, mix, crowd;
+	static int crowdSize = 4000, picked = -1;
+	// uploaded once; position and color attributes
+	if (cube == 0)
+	{
+		cube = meshRegistry().createOptimized(vertices, sizeof(vertices), indices, sizeof(indices), 6, { { 0, 3, 0 }, { 1, 3, 3 } });
+		setSingleInstance();
+	}
 
 	glm::mat4 trans(1.0f);
 	float time = (float)glfwGetTime();
 
-	unsigned int VAO;
-	glGenVertexArrays(1, &VAO);
-
-	unsigned int VBO;
-	glGenBuffers(1, &VBO);
-
-	unsigned int EBO;
-	glGenBuffers(1, &EBO);
-
 	// render loop
 	// -----------
 	{
@@ -142,18 +212,23 @@ void render_hw4(unsigned int shaderProgram)
 		ImGui::Checkbox("Scaling", &scale);
 		ImGui::SameLine();
 		ImGui::Checkbox("Mix", &mix);
+		ImGui::SameLine();
+		ImGui::Checkbox("Crowd", &crowd);
+		if (crowd)
+		{
+			ImGui::SliderInt("cubes", &crowdSize, 1, MAX_CROWD);
+			ImGui::Text("octree: %d nodes, %d moves relinked, %d nodes tested last", crowdTree.nodeCount(), crowdTree.relinked(), crowdTree.tested());
+			ImGui::Text("picked cube: %d (click a cube)", picked);
+		}
 
+		ImGui::Text("cube vertex cache: ACMR %.2f -> %.2f", meshRegistry().get(cube).acmrBefore, meshRegistry().get(cube).acmrAfter);
 		ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
 		ImGui::End();
 	}
 
 	if (mix)
 	{
-		float range = sin(time / 10) / 2;
-		trans = glm::translate(trans, glm::vec3(cos(time)*range, sin(time)* range, 0));
-		trans = glm::rotate(trans, (float)glfwGetTime(), glm::vec3(1.0f, 0.0f, 1.0f));
-		float section = abs(sin(time)) / 4 + 0.2;
-		trans = glm::scale(trans, glm::vec3(section, section, section));
+		trans = mixTransform(time);
 	}
 	else
 	{
@@ -175,35 +250,39 @@ void render_hw4(unsigned int shaderProgram)
 	glClear(GL_COLOR_BUFFER_BIT);
 	glClear(GL_DEPTH_BUFFER_BIT);
 	
-	glEnable(GL_DEPTH_TEST);
-
-	glUseProgram(shaderProgram);
-	glBindVertexArray(VAO);
-	//VBO
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_DYNAMIC_DRAW);
-	//EBO
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	glState().enable(GL_DEPTH_TEST);
+
+	glState().useProgram(shaderProgram);
+	if (crowd)
+	{
+		picked = renderCrowd(crowdSize, time, picked);
+		return;
+	}
+	if (!crowdIds.empty())
+	{
+		crowdTree.clear();
+		crowdIds.clear();
+		picked = -1;
+		setSingleInstance();
+	}
 	//uniform mat4
-	unsigned int transformLoc = glGetUniformLocation(shaderProgram, "transform");
-	glUniformMatrix4fv(transformLoc, 1, GL_FALSE, glm::value_ptr(trans));
-	//position
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	//color
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-
-	glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-
-	//unbind
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-
-	//delete
-	glDeleteVertexArrays(1, &VAO);
-	glDeleteBuffers(1, &VBO);
-	glDeleteBuffers(1, &EBO);
+	transform.set(trans);
+
+	meshRegistry().get(cube).drawInstanced();
+}
+
+void shutdown_hw4()
+{
+	delete shader;
+	shader = NULL;
+	if (cube != 0)
+		meshRegistry().release(cube);
+	cube = 0;
+	crowdTree.clear();
+	crowdIds.clear();
+}
+
+GLsizeiptr gpuBytes_hw4()
+{
+	return meshRegistry().gpuBytes(cube);
 }
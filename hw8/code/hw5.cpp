@@ -9,14 +9,24 @@
 #include "imgui_impl_opengl3.h"
 
 #include "hw.h"
+#include "shader.h"
 #include "camera.h"
+#include "mesh.h"
 
 #include <iostream>
 #include <algorithm>
 
 Camera camera(glm::vec3(0.0f, 0.0f, 20.0f));
 
-unsigned int load_hw5()
+// compiled in the background by init_hw5; the mesh is made on first render.
+// Both are freed by shutdown_hw5
+static Shader *shader;
+static MeshHandle cube;
+static Uniform<glm::mat4> modelUniform, viewUniform, projectionUniform;
+// projection picked in the UI, read by update_hw5 for the bonus camera
+static int pro;
+
+bool init_hw5()
 {
 	const char *vertexShaderSource = "#version 330 core\n"
 		"layout (location = 0) in vec3 aPos;\n"
@@ -39,50 +49,16 @@ unsigned int load_hw5()
 		"   FragColor = vec4(ourColor, 1.0f);\n"
 		"}\n\0";
 
-	int success;
-	char infoLog[512];
-	//create and compile vertex shader
-	unsigned int vertexShader;
-	vertexShader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-	glCompileShader(vertexShader);
-	// check for shader compile errors
-	glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-	if (!success)
-	{
-		glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-		std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-	}
-
-	//create and compile fragment shader
-	unsigned int fragmentShader;
-	fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-	glCompileShader(fragmentShader);
-	// check for shader compile errors
-	glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-	if (!success)
-	{
-		glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-		std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-	}
-
-	// link shaders
-	unsigned int shaderProgram;
-	shaderProgram = glCreateProgram();
-	glAttachShader(shaderProgram, vertexShader);
-	glAttachShader(shaderProgram, fragmentShader);
-	glLinkProgram(shaderProgram);
-	// check for linking errors
-	glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-	if (!success) {
-		glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-		std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-	}
-	glDeleteShader(vertexShader);
-	glDeleteShader(fragmentShader);
-
-	return shaderProgram;
+	// linked in the background, or loaded from the program cache
+	if (shader == NULL)
+		shader = new Shader(vertexShaderSource, fragmentShaderSource, nullptr, true);
+	if (!shader->ready())
+		return false;
+	// looked up once per program, again if it is rebuilt after a shutdown
+	modelUniform = shader->uniform<glm::mat4>("model");
+	viewUniform = shader->uniform<glm::mat4>("view");
+	projectionUniform = shader->uniform<glm::mat4>("projection");
+	return true;
 }
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
@@ -106,8 +82,29 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 	camera.ProcessMouseMovement(xoffset, yoffset);
 }
 
-void render_hw5(unsigned int shaderProgram, GLFWwindow *window)
+// camera input of the bonus projection
+void update_hw5(GLFWwindow *window)
+{
+	if (pro == 3)
+	{
+		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+		glfwSetCursorPosCallback(window, mouse_callback);
+	}
+
+	float deltaTime = 1.0f;
+	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+		camera.ProcessKeyboard(FORWARD, deltaTime);
+	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+		camera.ProcessKeyboard(BACKWARD, deltaTime);
+	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+		camera.ProcessKeyboard(LEFT, deltaTime);
+	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+		camera.ProcessKeyboard(RIGHT, deltaTime);
+}
+
+void render_hw5()
 {
+	unsigned int shaderProgram = shader->ID;
 	// set up vertex data (and buffer(s)) and configure vertex attributes
 	// ------------------------------------------------------------------
 	static float vertices[] = {
@@ -163,7 +160,6 @@ void render_hw5(unsigned int shaderProgram, GLFWwindow *window)
 		21, 22, 23
 	};
 
-	static int pro;
 	static float left = -10, right = 10, top = 10, bottom = -10, znear = 10, zfar = -10;
 	static float fovy = 45, aspect = 1, pnear = 0.1, pfar = 100;
 
@@ -173,14 +169,9 @@ void render_hw5(unsigned int shaderProgram, GLFWwindow *window)
 	float radius = 10.0f;
 	float time = (float)glfwGetTime();
 
-	unsigned int VAO;
-	glGenVertexArrays(1, &VAO);
-
-	unsigned int VBO;
-	glGenBuffers(1, &VBO);
-
-	unsigned int EBO;
-	glGenBuffers(1, &EBO);
+	// uploaded once; position and color attributes
+	if (cube == 0)
+		cube = meshRegistry().createOptimized(vertices, sizeof(vertices), indices, sizeof(indices), 6, { { 0, 3, 0 }, { 1, 3, 3 } });
 
 	// render loop
 	// -----------
@@ -213,24 +204,14 @@ void render_hw5(unsigned int shaderProgram, GLFWwindow *window)
 		case 2:
 			break;
 		case 3:
-			glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-			glfwSetCursorPosCallback(window, mouse_callback);
 			break;
 		}
 
+		ImGui::Text("cube vertex cache: ACMR %.2f -> %.2f", meshRegistry().get(cube).acmrBefore, meshRegistry().get(cube).acmrAfter);
 		ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
 		ImGui::End();
 	}
 
-	float deltaTime = 1.0f;
-	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-		camera.ProcessKeyboard(FORWARD, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-		camera.ProcessKeyboard(BACKWARD, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-		camera.ProcessKeyboard(LEFT, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-		camera.ProcessKeyboard(RIGHT, deltaTime);
 
 	//model = glm::translate(model, glm::vec3(-1.5f, 0.5f, -1.5f));
 	//model = glm::scale(model, glm::vec3(0.1f, 0.1f, 0.1f));
@@ -260,36 +241,27 @@ void render_hw5(unsigned int shaderProgram, GLFWwindow *window)
 	glClear(GL_COLOR_BUFFER_BIT);
 	glClear(GL_DEPTH_BUFFER_BIT);
 
-	glEnable(GL_DEPTH_TEST);
+	glState().enable(GL_DEPTH_TEST);
 
-	glUseProgram(shaderProgram);
-	glBindVertexArray(VAO);
-	//VBO
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_DYNAMIC_DRAW);
-	//EBO
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	glState().useProgram(shaderProgram);
 	//uniform mat4
-	glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-	glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-	glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-	//position
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	//color
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-
-	glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-
-	//unbind
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-
-	//delete
-	glDeleteVertexArrays(1, &VAO);
-	glDeleteBuffers(1, &VBO);
-	glDeleteBuffers(1, &EBO);
+	modelUniform.set(model);
+	viewUniform.set(view);
+	projectionUniform.set(projection);
+
+	meshRegistry().get(cube).draw();
+}
+
+void shutdown_hw5()
+{
+	delete shader;
+	shader = NULL;
+	if (cube != 0)
+		meshRegistry().release(cube);
+	cube = 0;
+}
+
+GLsizeiptr gpuBytes_hw5()
+{
+	return meshRegistry().gpuBytes(cube);
 }
@@ -11,20 +11,41 @@
 #include "hw.h"
 #include "shader.h"
 #include "camera.h"
+#include "mesh.h"
 
 #include <iostream>
 #include <algorithm>
 
-void render_hw6()
+// per-object uniform handles of one lighting program, resolved once after it is linked;
+// camera and light come from the shared uniform blocks
+struct LightingUniforms
+{
+	Uniform<glm::mat4> model;
+	Uniform<float> shininess;
+
+	LightingUniforms() {}
+	LightingUniforms(const Shader &shader) :
+		model(shader.uniform<glm::mat4>("model")),
+		shininess(shader.uniform<float>("material.shininess"))
+	{
+	}
+};
+
+// compiled in the background by init_hw6; the mesh is made on first render.
+// All are freed by shutdown_hw6
+static Shader *phong_shader, *gouraud_shader;
+static LightingUniforms phong_uniforms, gouraud_uniforms;
+static MeshHandle cube;
+
+bool init_hw6()
 {
 	//phong shader code
 	const char *phong_vs = "#version 330 core\n"
+		CAMERA_BLOCK_GLSL
 		"layout (location = 0) in vec3 aPos;\n"
 		"layout (location = 1) in vec3 aColor;\n"
 		"layout (location = 2) in vec3 aNormal;\n"
 		"uniform mat4 model;\n"
-		"uniform mat4 view;\n"
-		"uniform mat4 projection;\n"
 		"out vec3 ourColor;\n"
 		"out vec3 ourFragPos;\n"
 		"out vec3 ourNormal;\n"
@@ -37,6 +58,8 @@ void render_hw6()
 		"}\0";
 
 	const char *phong_fs = "#version 330 core\n"
+		CAMERA_BLOCK_GLSL
+		LIGHT_BLOCK_GLSL
 		"struct Material {\n"
 		"	/*\n"
 		"	vec3 ambient;\n"
@@ -45,18 +68,10 @@ void render_hw6()
 		"	*/\n"
 		"	float shininess;\n"
 		"	};\n"
-		"struct Light {\n"
-		"	vec3 ambient;\n"
-		"	vec3 diffuse;\n"
-		"	vec3 specular;\n"
-		"	vec3 position;\n"
-		"	};\n"
 		"in vec3 ourColor;\n"
 		"in vec3 ourFragPos;\n"
 		"in vec3 ourNormal;\n"
 		"uniform Material material;\n"
-		"uniform Light light;\n"
-		"uniform vec3 viewPos;\n"
 		"out vec4 FragColor;\n"
 		"void main()\n"
 		"{\n"
@@ -78,6 +93,8 @@ void render_hw6()
 		"}\n\0";
 	//gouraud shader code
 	static const char *gouraud_vs = "#version 330 core\n"
+		CAMERA_BLOCK_GLSL
+		LIGHT_BLOCK_GLSL
 		"layout (location = 0) in vec3 aPos;\n"
 		"layout (location = 1) in vec3 aColor;\n"
 		"layout (location = 2) in vec3 aNormal;\n"
@@ -89,18 +106,8 @@ void render_hw6()
 		"	*/\n"
 		"	float shininess;\n"
 		"	};\n"
-		"struct Light {\n"
-		"	vec3 ambient;\n"
-		"	vec3 diffuse;\n"
-		"	vec3 specular;\n"
-		"	vec3 position;\n"
-		"	};\n"
 		"uniform mat4 model;\n"
-		"uniform mat4 view;\n"
-		"uniform mat4 projection;\n"
 		"uniform Material material;\n"
-		"uniform Light light;\n"
-		"uniform vec3 viewPos;\n"
 		"out vec3 ourColor;\n"
 		"void main()\n"
 		"{\n"
@@ -130,6 +137,25 @@ void render_hw6()
 		"{\n"
 		"   FragColor = vec4(ourColor, 1.0f);\n"
 		"}\n\0";
+
+	if (phong_shader == NULL)
+	{
+		phong_shader = new Shader(phong_vs, phong_fs, nullptr, true);
+		gouraud_shader = new Shader(gouraud_vs, gouraud_fs, nullptr, true);
+	}
+	// poll both, so that their compiles overlap
+	bool phong_ready = phong_shader->ready();
+	bool gouraud_ready = gouraud_shader->ready();
+	if (!phong_ready || !gouraud_ready)
+		return false;
+	// looked up once per program, again if they are rebuilt after a shutdown
+	phong_uniforms = LightingUniforms(*phong_shader);
+	gouraud_uniforms = LightingUniforms(*gouraud_shader);
+	return true;
+}
+
+void render_hw6()
+{
 	// set up vertex data (and buffer(s)) and configure vertex attributes
 	// ------------------------------------------------------------------
 	static float vertices[] = {
@@ -191,11 +217,10 @@ void render_hw6()
 	static float ambient = 0.2, diffuse = 0.5, specular = 1.0, shininess = 256;
 	static glm::vec3 light(1.0f, 1.0f, 1.0f);
 	static Camera camera(glm::vec3(-3.0f, 0.5f, 3.0f), glm::vec3(0.0f, 1.0f, 0.0f), -45.0f, -5.0f);
-	static Shader phong_shader(phong_vs, phong_fs);
-	static Shader gouraud_shader(gouraud_vs, gouraud_fs);
 
 	float time = (float)glfwGetTime();
 	unsigned int shaderProgram;
+	const LightingUniforms *uniforms;
 
 	glm::mat4 model(1.0f);
 	glm::mat4 view(1.0f);
@@ -206,14 +231,9 @@ void render_hw6()
 	glm::vec3 lightDiffuse = diffuse * light;
 	glm::vec3 lightSpecular = specular * light;
 
-	unsigned int VAO;
-	glGenVertexArrays(1, &VAO);
-
-	unsigned int VBO;
-	glGenBuffers(1, &VBO);
-
-	unsigned int EBO;
-	glGenBuffers(1, &EBO);
+	// uploaded once; position, color and normal attributes
+	if (cube == 0)
+		cube = meshRegistry().createOptimized(vertices, sizeof(vertices), indices, sizeof(indices), 9, { { 0, 3, 0 }, { 1, 3, 3 }, { 2, 3, 6 } });
 
 	// render loop
 	// -----------
@@ -230,6 +250,7 @@ void render_hw6()
 		ImGui::SliderFloat("specular", &specular, 0, 1);
 		ImGui::SliderFloat("shininess", &shininess, 2, 512);
 
+		ImGui::Text("cube vertex cache: ACMR %.2f -> %.2f", meshRegistry().get(cube).acmrBefore, meshRegistry().get(cube).acmrAfter);
 		ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
 		ImGui::End();
 	}
@@ -246,54 +267,44 @@ void render_hw6()
 	glClear(GL_COLOR_BUFFER_BIT);
 	glClear(GL_DEPTH_BUFFER_BIT);
 
-	glEnable(GL_DEPTH_TEST);
+	glState().enable(GL_DEPTH_TEST);
 
 	switch (choice)
 	{
 	case 0:
-		shaderProgram = phong_shader.ID;
+		shaderProgram = phong_shader->ID;
+		uniforms = &phong_uniforms;
 		break;
-	case 1:
-		shaderProgram = gouraud_shader.ID;
+	default:
+		shaderProgram = gouraud_shader->ID;
+		uniforms = &gouraud_uniforms;
 		break;
 	}
-	glUseProgram(shaderProgram);
-	glBindVertexArray(VAO);
-	//VBO
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_DYNAMIC_DRAW);
-	//EBO
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	// shared by both programs, so switching shading sends nothing again
+	CameraBlock cameraBlock = { view, projection, glm::vec4(camera.Position, 1.0f) };
+	LightBlock lightBlock = { glm::vec4(lightAmbient, 0.0f), glm::vec4(lightDiffuse, 0.0f), glm::vec4(lightSpecular, 0.0f), glm::vec4(lightPos, 1.0f), glm::mat4(1.0f) };
+	cameraBuffer().update(cameraBlock);
+	lightBuffer().update(lightBlock);
+
+	glState().useProgram(shaderProgram);
 	//uniform mat4
-	glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-	glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-	glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-	glUniform1f(glGetUniformLocation(shaderProgram, "material.shininess"), shininess);
-	glUniform3fv(glGetUniformLocation(shaderProgram, "light.ambient"), 1, &lightAmbient[0]);
-	glUniform3fv(glGetUniformLocation(shaderProgram, "light.diffuse"), 1, &lightDiffuse[0]);
-	glUniform3fv(glGetUniformLocation(shaderProgram, "light.specular"), 1, &lightSpecular[0]);
-	glUniform3fv(glGetUniformLocation(shaderProgram, "light.position"), 1, &lightPos[0]);
-	glUniform3fv(glGetUniformLocation(shaderProgram, "viewPos"), 1, &camera.Position[0]);
-	//position
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 9 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	//color
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 9 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-	//normal
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 9 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
+	uniforms->model.set(model);
+	uniforms->shininess.set(shininess);
 	//draw
-	glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+	meshRegistry().get(cube).draw();
+}
 
-	//unbind
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
+void shutdown_hw6()
+{
+	delete phong_shader;
+	delete gouraud_shader;
+	phong_shader = gouraud_shader = NULL;
+	if (cube != 0)
+		meshRegistry().release(cube);
+	cube = 0;
+}
 
-	//delete
-	glDeleteVertexArrays(1, &VAO);
-	glDeleteBuffers(1, &VBO);
-	glDeleteBuffers(1, &EBO);
+GLsizeiptr gpuBytes_hw6()
+{
+	return meshRegistry().gpuBytes(cube);
 }
@@ -4,8 +4,9 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+// the stb_image implementation is compiled here, through the texture loader
 #define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
+#include "textureloader.h"
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
@@ -13,177 +14,303 @@
 #include "hw.h"
 #include "shader.h"
 #include "camera.h"
+#include "mesh.h"
+#include "renderqueue.h"
+#include "bvh.h"
+#include "profiler.h"
+#include "meshpool.h"
+#include "occlusion.h"
+#include "meshcache.h"
 
 #include <iostream>
 #include <algorithm>
+#include <vector>
+#include <cmath>
+#include <cstdio>
 
-GLuint loadTexture(GLchar* path)
+// made on first draw, freed by shutdown_hw7. The cube is made twice, since each pass draws the
+// cubes inside its own frustum from its own instance buffer
+static MeshHandle cube, shadowCube, plane;
+// model matrices of the cubes, drawn as instances; the stress scene fills the floor with more
+static std::vector<glm::mat4> cubeInstances;
+// boxes of the cubes for culling, and the cubes each pass drew last, whose matrices are uploaded
+static std::vector<Bounds> cubeBoxes;
+static BVH cubeTree;
+static std::vector<unsigned int> drawnCubes[2];
+static bool stressScene = false;
+static const int STRESS_CUBES = 100000;
+// shader location of the per-instance model matrix, which takes four locations
+static const GLuint INSTANCE_LOCATION = 3;
+// the floor and the cube in one pool, for drawing each pass with one multi-draw
+static MeshPool scenePool(8, { { 0, 3, 0 }, { 1, 3, 3 }, { 2, 2, 6 } }, INSTANCE_LOCATION);
+static int poolPlane, poolCube;
+static bool multiDraw = false;
+// hides the cubes the camera cannot see behind others, from queries of earlier frames
+static OcclusionCuller occlusion;
+static bool occlusionCulling = false;
+// an OBJ model loaded from the Shading window through the mesh cache, standing on the floor
+// behind the cubes, with lines on how it was loaded and on the last benchmark
+static MeshHandle modelMesh;
+static glm::mat4 modelMatrix;
+static float modelAcmr;
+static char modelStatus[128], benchmarkStatus[160];
+static char modelPath[256] = "model.obj";
+static const glm::vec3 MODEL_POSITION(0.0f, -0.5f, -3.0f);
+
+// The three cubes of the scene, joined by a field of small cubes over the floor in the stress scene
+static void buildCubeInstances()
 {
-	// Generate texture ID and load texture data 
-	GLuint textureID;
-	glGenTextures(1, &textureID);
-	int width, height, nrChannels;
-	unsigned char* image = stbi_load(path, &width, &height, &nrChannels, 0);
-	if (image)
+	cubeInstances.clear();
+	glm::mat4 model(1.0f);
+	model = glm::translate(model, glm::vec3(0.0f, 1.5f, 0.0));
+	cubeInstances.push_back(model);
+	model = glm::mat4(1.0f);
+	model = glm::translate(model, glm::vec3(2.0f, 0.0f, 1.0));
+	cubeInstances.push_back(model);
+	model = glm::mat4(1.0f);
+	model = glm::translate(model, glm::vec3(-1.0f, 0.0f, 2.0));
+	model = glm::rotate(model, 60.0f, glm::normalize(glm::vec3(1.0, 0.0, 1.0)));
+	model = glm::scale(model, glm::vec3(0.5));
+	cubeInstances.push_back(model);
+	if (stressScene)
 	{
-		// Assign texture to ID
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-		glGenerateMipmap(GL_TEXTURE_2D);
-		// Parameters
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		// unbind and free
-		glBindTexture(GL_TEXTURE_2D, 0);
-		stbi_image_free(image);
+		// a grid inside the light's frustum, so every cube casts a shadow
+		int side = (int)std::ceil(std::sqrt((float)STRESS_CUBES));
+		for (int i = 3; i < STRESS_CUBES; i++)
+		{
+			float x = -10.0f + 20.0f * (i % side + 0.5f) / side;
+			float z = -10.0f + 20.0f * (i / side + 0.5f) / side;
+			model = glm::mat4(1.0f);
+			model = glm::translate(model, glm::vec3(x, -0.45f + 0.25f * (std::sin(x) * std::cos(z) + 1.0f), z));
+			model = glm::rotate(model, (float)i, glm::vec3(0.0f, 1.0f, 0.0f));
+			model = glm::scale(model, glm::vec3(0.05f));
+			cubeInstances.push_back(model);
+		}
+	}
+	// box of the transformed unit cube: each axis spans half the absolute row sum of the matrix
+	cubeBoxes.resize(cubeInstances.size());
+	for (size_t i = 0; i < cubeInstances.size(); i++)
+	{
+		const glm::mat4 &m = cubeInstances[i];
+		glm::vec3 extent = 0.5f * (glm::abs(glm::vec3(m[0])) + glm::abs(glm::vec3(m[1])) + glm::abs(glm::vec3(m[2])));
+		cubeBoxes[i].min = glm::vec3(m[3]) - extent;
+		cubeBoxes[i].max = glm::vec3(m[3]) + extent;
+	}
+	occlusion.reset(cubeInstances.size());
+	ProfileScope scope("BVH build");
+	cubeTree.build(cubeBoxes);
+	drawnCubes[0].clear();
+	drawnCubes[1].clear();
+}
+
+// Replaces the model with the one at modelPath, scaled to fit 2 units
+static void loadModel()
+{
+	MeshData mesh;
+	if (!meshCache().load(modelPath, mesh))
+		return;
+	if (modelMesh != 0)
+		meshRegistry().release(modelMesh);
+	double start = glfwGetTime();
+	modelMesh = mesh.create();
+	double upload = (glfwGetTime() - start) * 1000.0;
+	if (mesh.cached)
+		snprintf(modelStatus, sizeof(modelStatus), "model: %d triangles, %d vertices, mapped in %.1f ms, uploaded in %.1f ms, ACMR %.2f -> %.2f",
+			mesh.triangleCount(), mesh.vertexCount(), mesh.milliseconds, upload, mesh.acmrBefore, mesh.acmrAfter);
+	else
+		snprintf(modelStatus, sizeof(modelStatus), "model: %d triangles, %d vertices, parsed in %.1f ms (%.1f MB/s), ACMR %.2f -> %.2f",
+			mesh.triangleCount(), mesh.vertexCount(), mesh.mesh.milliseconds, mesh.mesh.megabytesPerSecond(), mesh.acmrBefore, mesh.acmrAfter);
+	benchmarkStatus[0] = 0;
+	modelAcmr = mesh.acmrAfter;
+	glm::vec3 size = mesh.max - mesh.min;
+	float scale = 2.0f / std::max(std::max(size.x, size.y), std::max(size.z, 1e-6f));
+	modelMatrix = glm::mat4(1.0f);
+	modelMatrix = glm::translate(modelMatrix, MODEL_POSITION);
+	modelMatrix = glm::scale(modelMatrix, glm::vec3(scale));
+	modelMatrix = glm::translate(modelMatrix, -glm::vec3((mesh.min.x + mesh.max.x) * 0.5f, mesh.min.y, (mesh.min.z + mesh.max.z) * 0.5f));
+	meshRegistry().setInstances(modelMesh, glm::value_ptr(modelMatrix), 1, INSTANCE_LOCATION);
+}
+
+// the scene's geometry: positions, normals and texture coords
+static const GLfloat cubeVertices[] = {
+	// Back face
+	-0.5f, -0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 0.0f, 0.0f, // Bottom-left
+	0.5f, 0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 1.0f, 1.0f, // top-right
+	0.5f, -0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 1.0f, 0.0f, // bottom-right         
+	0.5f, 0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 1.0f, 1.0f,  // top-right
+	-0.5f, -0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 0.0f, 0.0f,  // bottom-left
+	-0.5f, 0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 0.0f, 1.0f,// top-left
+	// Front face
+	-0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, // bottom-left
+	0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f,  // bottom-right
+	0.5f, 0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f,  // top-right
+	0.5f, 0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, // top-right
+	-0.5f, 0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f,  // top-left
+	-0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f,  // bottom-left
+	// Left face
+	-0.5f, 0.5f, 0.5f, -1.0f, 0.0f, 0.0f, 1.0f, 0.0f, // top-right
+	-0.5f, 0.5f, -0.5f, -1.0f, 0.0f, 0.0f, 1.0f, 1.0f, // top-left
+	-0.5f, -0.5f, -0.5f, -1.0f, 0.0f, 0.0f, 0.0f, 1.0f,  // bottom-left
+	-0.5f, -0.5f, -0.5f, -1.0f, 0.0f, 0.0f, 0.0f, 1.0f, // bottom-left
+	-0.5f, -0.5f, 0.5f, -1.0f, 0.0f, 0.0f, 0.0f, 0.0f,  // bottom-right
+	-0.5f, 0.5f, 0.5f, -1.0f, 0.0f, 0.0f, 1.0f, 0.0f, // top-right
+	// Right face
+	0.5f, 0.5f, 0.5f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, // top-left
+	0.5f, -0.5f, -0.5f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, // bottom-right
+	0.5f, 0.5f, -0.5f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, // top-right         
+	0.5f, -0.5f, -0.5f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f,  // bottom-right
+	0.5f, 0.5f, 0.5f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f,  // top-left
+	0.5f, -0.5f, 0.5f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, // bottom-left     
+	// Bottom face
+	-0.5f, -0.5f, -0.5f, 0.0f, -1.0f, 0.0f, 0.0f, 1.0f, // top-right
+	0.5f, -0.5f, -0.5f, 0.0f, -1.0f, 0.0f, 1.0f, 1.0f, // top-left
+	0.5f, -0.5f, 0.5f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f,// bottom-left
+	0.5f, -0.5f, 0.5f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, // bottom-left
+	-0.5f, -0.5f, 0.5f, 0.0f, -1.0f, 0.0f, 0.0f, 0.0f, // bottom-right
+	-0.5f, -0.5f, -0.5f, 0.0f, -1.0f, 0.0f, 0.0f, 1.0f, // top-right
+	// Top face
+	-0.5f, 0.5f, -0.5f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f,// top-left
+	0.5f, 0.5f, 0.5f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, // bottom-right
+	0.5f, 0.5f, -0.5f, 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, // top-right     
+	0.5f, 0.5f, 0.5f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, // bottom-right
+	-0.5f, 0.5f, -0.5f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f,// top-left
+	-0.5f, 0.5f, 0.5f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f // bottom-left        
+};
+
+static const GLfloat planeVertices[] = {
+	// Positions     Normals   Texture Coords
+	25.0f, -0.5f, 25.0f, 0.0f, 1.0f, 0.0f, 25.0f, 0.0f,
+	-25.0f, -0.5f, -25.0f, 0.0f, 1.0f, 0.0f, 0.0f, 25.0f,
+	-25.0f, -0.5f, 25.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f,
+
+	25.0f, -0.5f, 25.0f, 0.0f, 1.0f, 0.0f, 25.0f, 0.0f,
+	25.0f, -0.5f, -25.0f, 0.0f, 1.0f, 0.0f, 25.0f, 25.0f,
+	-25.0f, -0.5f, -25.0f, 0.0f, 1.0f, 0.0f, 0.0f, 25.0f
+};
+
+// the passes of a frame, in the order the render queue runs them
+enum { DEPTH_PASS = 0, LIT_PASS = 1 };
+
+// The cubes a pass draws: those inside its frustum, less those the camera saw hidden
+static void cullCubes(int pass, const Frustum &frustum, std::vector<unsigned int> &visible)
+{
+	ProfileScope scope("BVH cull");
+	if (pass == LIT_PASS && occlusionCulling)
+	{
+		std::vector<unsigned int> candidates;
+		cubeTree.cull(frustum, candidates);
+		occlusion.filter(candidates, visible);
 	}
-	else {
-		std::cout << "Failed to load texture" << std::endl;
+	else
+	{
+		cubeTree.cull(frustum, visible);
 	}
-	return textureID;
 }
 
-void RenderCube()
+// Queues the cubes inside the frustum as one instanced draw with the program and textures of
+// command. Their matrices are uploaded only when the set of cubes changes.
+void RenderCube(int pass, DrawCommand command, const glm::vec3 &eye, const Frustum &frustum)
 {
-	static GLuint cubeVAO;
-	if (cubeVAO == 0)
+	if (cube == 0)
 	{
-		GLuint cubeVBO;
-		GLfloat vertices[] = {
-			// Back face
-			-0.5f, -0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 0.0f, 0.0f, // Bottom-left
-			0.5f, 0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 1.0f, 1.0f, // top-right
-			0.5f, -0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 1.0f, 0.0f, // bottom-right         
-			0.5f, 0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 1.0f, 1.0f,  // top-right
-			-0.5f, -0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 0.0f, 0.0f,  // bottom-left
-			-0.5f, 0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 0.0f, 1.0f,// top-left
-			// Front face
-			-0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, // bottom-left
-			0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f,  // bottom-right
-			0.5f, 0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f,  // top-right
-			0.5f, 0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, // top-right
-			-0.5f, 0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f,  // top-left
-			-0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f,  // bottom-left
-			// Left face
-			-0.5f, 0.5f, 0.5f, -1.0f, 0.0f, 0.0f, 1.0f, 0.0f, // top-right
-			-0.5f, 0.5f, -0.5f, -1.0f, 0.0f, 0.0f, 1.0f, 1.0f, // top-left
-			-0.5f, -0.5f, -0.5f, -1.0f, 0.0f, 0.0f, 0.0f, 1.0f,  // bottom-left
-			-0.5f, -0.5f, -0.5f, -1.0f, 0.0f, 0.0f, 0.0f, 1.0f, // bottom-left
-			-0.5f, -0.5f, 0.5f, -1.0f, 0.0f, 0.0f, 0.0f, 0.0f,  // bottom-right
-			-0.5f, 0.5f, 0.5f, -1.0f, 0.0f, 0.0f, 1.0f, 0.0f, // top-right
-			// Right face
-			0.5f, 0.5f, 0.5f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, // top-left
-			0.5f, -0.5f, -0.5f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, // bottom-right
-			0.5f, 0.5f, -0.5f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, // top-right         
-			0.5f, -0.5f, -0.5f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f,  // bottom-right
-			0.5f, 0.5f, 0.5f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f,  // top-left
-			0.5f, -0.5f, 0.5f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, // bottom-left     
-			// Bottom face
-			-0.5f, -0.5f, -0.5f, 0.0f, -1.0f, 0.0f, 0.0f, 1.0f, // top-right
-			0.5f, -0.5f, -0.5f, 0.0f, -1.0f, 0.0f, 1.0f, 1.0f, // top-left
-			0.5f, -0.5f, 0.5f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f,// bottom-left
-			0.5f, -0.5f, 0.5f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, // bottom-left
-			-0.5f, -0.5f, 0.5f, 0.0f, -1.0f, 0.0f, 0.0f, 0.0f, // bottom-right
-			-0.5f, -0.5f, -0.5f, 0.0f, -1.0f, 0.0f, 0.0f, 1.0f, // top-right
-			// Top face
-			-0.5f, 0.5f, -0.5f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f,// top-left
-			0.5f, 0.5f, 0.5f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, // bottom-right
-			0.5f, 0.5f, -0.5f, 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, // top-right     
-			0.5f, 0.5f, 0.5f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, // bottom-right
-			-0.5f, 0.5f, -0.5f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f,// top-left
-			-0.5f, 0.5f, 0.5f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f // bottom-left        
-		};
-		glGenVertexArrays(1, &cubeVAO);
-		glGenBuffers(1, &cubeVBO);
-		// Fill buffer
-		glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-		// Link vertex attributes
-		glBindVertexArray(cubeVAO);
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (GLvoid*)0);
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (GLvoid*)(6 * sizeof(GLfloat)));
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		glBindVertexArray(0);
+		cube = meshRegistry().create(cubeVertices, sizeof(cubeVertices), NULL, 0, 8, { { 0, 3, 0 }, { 1, 3, 3 }, { 2, 2, 6 } });
+		shadowCube = meshRegistry().create(cubeVertices, sizeof(cubeVertices), NULL, 0, 8, { { 0, 3, 0 }, { 1, 3, 3 }, { 2, 2, 6 } });
+		buildCubeInstances();
 	}
+	std::vector<unsigned int> visible;
+	cullCubes(pass, frustum, visible);
+	MeshHandle mesh = pass == DEPTH_PASS ? shadowCube : cube;
+	if (visible != drawnCubes[pass])
+	{
+		drawnCubes[pass].swap(visible);
+		std::vector<glm::mat4> matrices(drawnCubes[pass].size());
+		for (size_t i = 0; i < matrices.size(); i++)
+			matrices[i] = cubeInstances[drawnCubes[pass][i]];
+		if (!matrices.empty())
+			meshRegistry().setInstances(mesh, glm::value_ptr(matrices[0]), (GLsizei)matrices.size(), INSTANCE_LOCATION);
+	}
+	if (drawnCubes[pass].empty())
+		return;
 	// Render Cube
-	glBindVertexArray(cubeVAO);
-	glDrawArrays(GL_TRIANGLES, 0, 36);
-	glBindVertexArray(0);
+	command.mesh = mesh;
+	command.instanced = true;
+	command.depth = glm::length(glm::vec3(cubeInstances[drawnCubes[pass][0]][3]) - eye) / 100.0f;
+	renderQueue().submit(pass, command);
 }
 
-void RenderScene(Shader &shader)
+// Queues the scene for one pass, seen from eye through frustum. Both programs read the model
+// matrix per instance, so the scene is at most two draws in either pass
+void RenderScene(int pass, DrawCommand command, const glm::vec3 &eye, const Frustum &frustum)
 {
-	static GLuint planeVAO;
-	if (planeVAO == 0)
+	if (plane == 0)
 	{
-		GLuint planeVBO;
-		static float vertices[] = {
-			// Positions     Normals   Texture Coords
-			25.0f, -0.5f, 25.0f, 0.0f, 1.0f, 0.0f, 25.0f, 0.0f,
-			-25.0f, -0.5f, -25.0f, 0.0f, 1.0f, 0.0f, 0.0f, 25.0f,
-			-25.0f, -0.5f, 25.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f,
-
-			25.0f, -0.5f, 25.0f, 0.0f, 1.0f, 0.0f, 25.0f, 0.0f,
-			25.0f, -0.5f, -25.0f, 0.0f, 1.0f, 0.0f, 25.0f, 25.0f,
-			-25.0f, -0.5f, -25.0f, 0.0f, 1.0f, 0.0f, 0.0f, 25.0f
-		};
-		glGenVertexArrays(1, &planeVAO);
-		glGenBuffers(1, &planeVBO);
-		glBindVertexArray(planeVAO);
-		// fill buffer
-		glBindBuffer(GL_ARRAY_BUFFER, planeVBO);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_DYNAMIC_DRAW);
-		// Link vertex attributes
-		glBindVertexArray(planeVAO);
-		//bind data
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (GLvoid*)0);
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (GLvoid*)(6 * sizeof(GLfloat)));
-		glBindVertexArray(planeVAO);
+		plane = meshRegistry().create(planeVertices, sizeof(planeVertices), NULL, 0, 8, { { 0, 3, 0 }, { 1, 3, 3 }, { 2, 2, 6 } });
+		glm::mat4 model(1.0f);
+		meshRegistry().setInstances(plane, glm::value_ptr(model), 1, INSTANCE_LOCATION);
+	}
+	// Floor, which lies behind everything else, so it goes last
+	command.mesh = plane;
+	command.instanced = true;
+	command.depth = 1.0f;
+	renderQueue().submit(pass, command);
+
+	// Model
+	if (modelMesh != 0)
+	{
+		command.mesh = modelMesh;
+		command.depth = glm::length(MODEL_POSITION - eye) / 100.0f;
+		renderQueue().submit(pass, command);
 	}
-	// Floor
-	glm::mat4 model(1.0f);
-	glUniformMatrix4fv(glGetUniformLocation(shader.ID, "model"), 1, GL_FALSE, glm::value_ptr(model));
-	glBindVertexArray(planeVAO);
-	glDrawArrays(GL_TRIANGLES, 0, 6);
-	glBindVertexArray(0);
 
 	// Cubes
-	model = glm::mat4(1.0f);
-	model = glm::translate(model, glm::vec3(0.0f, 1.5f, 0.0));
-	glUniformMatrix4fv(glGetUniformLocation(shader.ID, "model"), 1, GL_FALSE, glm::value_ptr(model));
-	RenderCube();
-	model = glm::mat4(1.0f);
-	model = glm::translate(model, glm::vec3(2.0f, 0.0f, 1.0));
-	glUniformMatrix4fv(glGetUniformLocation(shader.ID, "model"), 1, GL_FALSE, glm::value_ptr(model));
-	RenderCube();
-	model = glm::mat4(1.0f);
-	model = glm::translate(model, glm::vec3(-1.0f, 0.0f, 2.0));
-	model = glm::rotate(model, 60.0f, glm::normalize(glm::vec3(1.0, 0.0, 1.0)));
-	model = glm::scale(model, glm::vec3(0.5));
-	glUniformMatrix4fv(glGetUniformLocation(shader.ID, "model"), 1, GL_FALSE, glm::value_ptr(model));
-	RenderCube();
+	RenderCube(pass, command, eye, frustum);
 }
 
-void render_hw7()
+// Draws the scene for one pass from the mesh pool with the program and textures that are bound:
+// the culled cubes and the floor become the commands of a single multi-draw
+void RenderScenePooled(int pass, const Frustum &frustum)
+{
+	if (!scenePool.uploaded())
+	{
+		poolPlane = scenePool.add(planeVertices, sizeof(planeVertices), NULL, 0);
+		poolCube = scenePool.add(cubeVertices, sizeof(cubeVertices), NULL, 0);
+		scenePool.upload();
+	}
+	if (cubeInstances.empty())
+		buildCubeInstances();
+	drawnCubes[pass].clear();
+	cullCubes(pass, frustum, drawnCubes[pass]);
+	std::vector<glm::mat4> matrices(drawnCubes[pass].size());
+	for (size_t i = 0; i < matrices.size(); i++)
+		matrices[i] = cubeInstances[drawnCubes[pass][i]];
+	glm::mat4 identity(1.0f);
+	scenePool.draw(poolCube, matrices.data(), (GLsizei)matrices.size());
+	scenePool.draw(poolPlane, &identity, 1);
+	scenePool.submit();
+	// the model is not in the pool, which is built once
+	if (modelMesh != 0)
+		meshRegistry().get(modelMesh).drawInstanced();
+}
+
+// built by init_hw7: the programs compile in the background and the box texture streams in
+// through the texture loader, drawn with its placeholder until then. All are freed by shutdown_hw7
+static Shader *simpleDepthShader, *or_shader;
+static TextureHandle boxTexture;
+static GLuint depthMapFBO, depthMap;
+static const GLuint SHADOW_WIDTH = 1024, SHADOW_HEIGHT = 1024;
+// uniform handles, resolved once the programs are linked
+static Uniform<int> orDiffuseTexture, orShadowMap, orOptim;
+
+bool init_hw7()
 {
 	//depth shader code
 	static const char *depth_shader_vs = "#version 330 core\n"
+		LIGHT_BLOCK_GLSL
 		"layout (location = 0) in vec3 position;\n"
-		"uniform mat4 lightSpaceMatrix;\n"
-		"uniform mat4 model;\n"
+		"layout (location = 3) in mat4 model;\n"
 		"void main()\n"
 		"{\n"
-		"   gl_Position = lightSpaceMatrix * model * vec4(position, 1.0f);\n"
+		"   gl_Position = light.lightSpaceMatrix * model * vec4(position, 1.0f);\n"
 		"}\0";
 
 	static const char *depth_shader_fs = "#version 330 core\n"
@@ -193,13 +320,12 @@ void render_hw7()
 		"}\n\0";
 	//orthogonal shader code
 	static const char *or_shader_vs = "#version 330 core\n"
+		CAMERA_BLOCK_GLSL
+		LIGHT_BLOCK_GLSL
 		"layout (location = 0) in vec3 position;\n"
 		"layout (location = 1) in vec3 normal;\n"
 		"layout (location = 2) in vec2 texCoords_vs;\n"
-		"uniform mat4 model;\n"
-		"uniform mat4 view;\n"
-		"uniform mat4 projection;\n"
-		"uniform mat4 lightSpaceMatrix;\n"
+		"layout (location = 3) in mat4 model;\n"
 		"out VS_OUT {\n"
 		"	vec3 FragPos;\n"
 		"	vec3 Normal;\n"
@@ -212,25 +338,19 @@ void render_hw7()
 		"	out_vs.FragPos = vec3(model * vec4(position, 1.0f));\n"
 		"   out_vs.Normal = transpose(inverse(mat3(model))) * normal;\n"
 		"   out_vs.TexCoords = texCoords_vs;\n"
-		"   out_vs.FragPosLightSpace = lightSpaceMatrix * vec4(out_vs.FragPos, 1.0f);\n"
+		"   out_vs.FragPosLightSpace = light.lightSpaceMatrix * vec4(out_vs.FragPos, 1.0f);\n"
 		"}\0";
 	static const char *or_shader_fs = "#version 330 core\n"
+		CAMERA_BLOCK_GLSL
+		LIGHT_BLOCK_GLSL
 		"in VS_OUT {\n"
 		"	vec3 FragPos;\n"
 		"	vec3 Normal;\n"
 		"	vec2 TexCoords;\n"
 		"	vec4 FragPosLightSpace;\n"
 		"} in_fs;\n"
-		"struct Light {\n"
-		"	vec3 ambient;\n"
-		"	vec3 diffuse;\n"
-		"	vec3 specular;\n"
-		"	vec3 position;\n"
-		"	};\n"
 		"uniform sampler2D diffuseTexture;\n"
 		"uniform sampler2D shadowMap;\n"
-		"uniform vec3 viewPos;\n"
-		"uniform Light light;\n"
 		"uniform int optim;\n"
 		"out vec4 FragColor;\n"
 		"float ShadowCalculation(vec4 fragPosLightSpace)\n"
@@ -290,32 +410,15 @@ void render_hw7()
 		"   FragColor = vec4(result, 1.0f);\n"
 		"}\n\0";
 
-	static bool optim = false;
-	static float ambient = 0.2, diffuse = 0.5, specular = 1.0;
-	static glm::vec3 light(1.0f, 1.0f, 1.0f);
-	static Camera camera(glm::vec3(0.0f, 0.0f, 6.0f));
-	static Shader simpleDepthShader(depth_shader_vs, depth_shader_fs);
-	static Shader or_shader(or_shader_vs, or_shader_fs);
-	static GLchar path[] = "container.jpg";
-	static GLuint boxTexture = loadTexture(path);
-
-	float time = (float)glfwGetTime();
-
-	glm::mat4 model(1.0f), view(1.0f), projection(1.0f);
-	glm::mat4 lightProjection(1.0f), lightView(1.0f), lightSpaceMatrix(1.0f);
-
-	glm::vec3 lightPos(-2.0f, 4.0f, -1.0f);
-	glm::vec3 lightAmbient = ambient * light;
-	glm::vec3 lightDiffuse = diffuse * light;
-	glm::vec3 lightSpecular = specular * light;
-
-	const GLuint SHADOW_WIDTH = 1024, SHADOW_HEIGHT = 1024;
-	static GLuint depthMapFBO, depthMap;
-	if (depthMapFBO == 0 && depthMap == 0)
+	if (simpleDepthShader == NULL)
 	{
+		simpleDepthShader = new Shader(depth_shader_vs, depth_shader_fs, nullptr, true);
+		or_shader = new Shader(or_shader_vs, or_shader_fs, nullptr, true);
+		boxTexture = textureLoader().load("container.jpg");
+
 		glGenFramebuffers(1, &depthMapFBO);
 		glGenTextures(1, &depthMap);
-		glBindTexture(GL_TEXTURE_2D, depthMap);
+		glState().bindTexture(GL_TEXTURE_2D, depthMap);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -328,6 +431,102 @@ void render_hw7()
 		glReadBuffer(GL_NONE);
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	}
+	bool depthReady = simpleDepthShader->ready();
+	bool orReady = or_shader->ready();
+	if (!depthReady || !orReady)
+		return false;
+	orDiffuseTexture = or_shader->uniform<int>("diffuseTexture");
+	orShadowMap = or_shader->uniform<int>("shadowMap");
+	orOptim = or_shader->uniform<int>("optim");
+	return true;
+}
+
+// Binds the target of a pass and clears it; called by the render queue
+static void beginPass_hw7(int pass)
+{
+	if (pass == DEPTH_PASS)
+	{
+		glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+		glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+		glClear(GL_DEPTH_BUFFER_BIT);
+	}
+	else
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	}
+}
+
+// Vertex cost of the model with its triangles in file order against the optimized order. Both
+// are drawn BENCHMARK_DRAWS times into the shadow map under a timer query and, where the driver
+// counts them, a vertex shader invocation query; otherwise the runs are estimated from the
+// simulated cache. Waits for the results, so it only runs when asked.
+static void benchmarkModel()
+{
+	const int BENCHMARK_DRAWS = 20;
+	ObjLoader loader;
+	ObjMesh raw;
+	if (modelMesh == 0 || !loader.load(modelPath, raw))
+		return;
+	MeshHandle rawMesh = raw.create();
+	meshRegistry().setInstances(rawMesh, glm::value_ptr(modelMatrix), 1, INSTANCE_LOCATION);
+	MeshHandle meshes[2] = { rawMesh, modelMesh };
+	double milliseconds[2];
+	GLuint64 invocations[2] = { 0, 0 };
+	bool counted = glExtensions().pipelineStatistics;
+	GLuint queries[2];
+	glGenQueries(2, queries);
+	glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+	glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+	glState().enable(GL_DEPTH_TEST);
+	simpleDepthShader->use();
+	for (int i = 0; i < 2; i++)
+	{
+		glClear(GL_DEPTH_BUFFER_BIT);
+		glBeginQuery(GL_TIME_ELAPSED, queries[0]);
+		if (counted)
+			glBeginQuery(GL_VERTEX_SHADER_INVOCATIONS, queries[1]);
+		for (int draw = 0; draw < BENCHMARK_DRAWS; draw++)
+			meshRegistry().get(meshes[i]).drawInstanced();
+		if (counted)
+			glEndQuery(GL_VERTEX_SHADER_INVOCATIONS);
+		glEndQuery(GL_TIME_ELAPSED);
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &nanoseconds);
+		milliseconds[i] = nanoseconds / 1e6 / BENCHMARK_DRAWS;
+		if (counted)
+			glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &invocations[i]);
+	}
+	glDeleteQueries(2, queries);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+	meshRegistry().release(rawMesh);
+	if (!counted)
+	{
+		invocations[0] = (GLuint64)(acmr(raw.indices.data(), raw.indices.size(), raw.vertices.size() / ObjMesh::STRIDE) * raw.triangleCount) * BENCHMARK_DRAWS;
+		invocations[1] = (GLuint64)(modelAcmr * raw.triangleCount) * BENCHMARK_DRAWS;
+	}
+	snprintf(benchmarkStatus, sizeof(benchmarkStatus), "file order %.2f ms, optimized %.2f ms per draw; vertex shader runs %llu -> %llu%s",
+		milliseconds[0], milliseconds[1], (unsigned long long)invocations[0], (unsigned long long)invocations[1], counted ? "" : " (simulated)");
+}
+
+void render_hw7()
+{
+	static bool optim = false;
+	static float ambient = 0.2, diffuse = 0.5, specular = 1.0;
+	static glm::vec3 light(1.0f, 1.0f, 1.0f);
+	static Camera camera(glm::vec3(0.0f, 0.0f, 6.0f));
+
+	float time = (float)glfwGetTime();
+
+	glm::mat4 model(1.0f), view(1.0f), projection(1.0f);
+	glm::mat4 lightProjection(1.0f), lightView(1.0f), lightSpaceMatrix(1.0f);
+
+	glm::vec3 lightPos(-2.0f, 4.0f, -1.0f);
+	glm::vec3 lightAmbient = ambient * light;
+	glm::vec3 lightDiffuse = diffuse * light;
+	glm::vec3 lightSpecular = specular * light;
 
 	{
 		ImGui::Begin("Shading");
@@ -336,48 +535,89 @@ void render_hw7()
 		ImGui::SliderFloat("diffuse", &diffuse, 0, 1);
 		ImGui::SliderFloat("specular", &specular, 0, 1);
 		ImGui::Checkbox("bonous", &optim);
+		if (ImGui::Checkbox("stress (100k cubes)", &stressScene) && !cubeInstances.empty())
+			buildCubeInstances();
+		// the instance buffers of the queued path are filled again after the pooled one ran
+		if (ImGui::Checkbox(glExtensions().multiDrawIndirect ? "multi-draw indirect" : "multi-draw indirect (emulated)", &multiDraw))
+		{
+			drawnCubes[0].clear();
+			drawnCubes[1].clear();
+		}
+		if (multiDraw)
+			ImGui::Text("%d draw calls in the last pass", scenePool.drawCalls());
+		if (ImGui::Checkbox("occlusion culling", &occlusionCulling))
+			occlusion.reset(cubeInstances.size());
+		if (occlusionCulling)
+			ImGui::Text("occlusion: %d cubes hidden, %d queries issued, %d in flight", occlusion.hidden(), occlusion.queries(), occlusion.inFlight());
+		ImGui::InputText("model", modelPath, sizeof(modelPath));
+		ImGui::SameLine();
+		if (ImGui::Button("load"))
+			loadModel();
+		if (modelMesh != 0)
+		{
+			ImGui::Text("%s", modelStatus);
+			if (ImGui::Button("benchmark index order"))
+				benchmarkModel();
+			if (benchmarkStatus[0] != 0)
+				ImGui::Text("%s", benchmarkStatus);
+		}
+		ImGui::Text("%d cubes, %d drawn for the camera, %d for the light", (int)cubeInstances.size(), (int)drawnCubes[LIT_PASS].size(), (int)drawnCubes[DEPTH_PASS].size());
+		ImGui::Text("culling: %d of %d nodes tested last", cubeTree.visited(), cubeTree.nodeCount());
 
 		ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
 		ImGui::End();
 	}
 
 	glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-	glEnable(GL_DEPTH_TEST);
+	glState().enable(GL_DEPTH_TEST);
 
-	// 1. depth mapping
-	simpleDepthShader.use();
+	// camera and light blocks are filled once and read by both passes
 	lightProjection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, 1.0f, 7.5f);
 	lightView = glm::lookAt(lightPos, glm::vec3(0.0f), glm::vec3(0.0, 1.0, 0.0));
 	lightSpaceMatrix = lightProjection * lightView;
-	glUniformMatrix4fv(glGetUniformLocation(simpleDepthShader.ID, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
-	glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-	glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-	glClear(GL_DEPTH_BUFFER_BIT);
-	RenderScene(simpleDepthShader);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	// 2. render
-	glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	or_shader.use();
 	projection = glm::perspective(camera.Zoom, (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
 	view = camera.GetViewMatrix();
-	glUniform1i(glGetUniformLocation(or_shader.ID, "diffuseTexture"), 0);
-	glUniform1i(glGetUniformLocation(or_shader.ID, "shadowMap"), 1);
-	glUniformMatrix4fv(glGetUniformLocation(or_shader.ID, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-	glUniformMatrix4fv(glGetUniformLocation(or_shader.ID, "view"), 1, GL_FALSE, glm::value_ptr(view));
-	// Set light uniforms
-	glUniform3fv(glGetUniformLocation(or_shader.ID, "light.ambient"), 1, &lightAmbient[0]);
-	glUniform3fv(glGetUniformLocation(or_shader.ID, "light.diffuse"), 1, &lightDiffuse[0]);
-	glUniform3fv(glGetUniformLocation(or_shader.ID, "light.specular"), 1, &lightSpecular[0]);
-	glUniform3fv(glGetUniformLocation(or_shader.ID, "light.position"), 1, &lightPos[0]);
-	glUniform1i(glGetUniformLocation(or_shader.ID, "optim"), int(optim));
-	glUniform3fv(glGetUniformLocation(or_shader.ID, "viewPos"), 1, &camera.Position[0]);
-	glUniformMatrix4fv(glGetUniformLocation(or_shader.ID, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, boxTexture);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, depthMap);
-	RenderScene(or_shader);
+	CameraBlock cameraBlock = { view, projection, glm::vec4(camera.Position, 1.0f) };
+	LightBlock lightBlock = { glm::vec4(lightAmbient, 0.0f), glm::vec4(lightDiffuse, 0.0f), glm::vec4(lightSpecular, 0.0f), glm::vec4(lightPos, 1.0f), lightSpaceMatrix };
+	cameraBuffer().update(cameraBlock);
+	lightBuffer().update(lightBlock);
+
+	// uniforms are program state, so they are set before the queue runs
+	or_shader->use();
+	orDiffuseTexture.set(0);
+	orShadowMap.set(1);
+	orOptim.set(int(optim));
+	// results of earlier frames decide which cubes the camera draws
+	if (occlusionCulling)
+		occlusion.collect();
+	if (multiDraw)
+	{
+		// 1. depth mapping
+		beginPass_hw7(DEPTH_PASS);
+		simpleDepthShader->use();
+		RenderScenePooled(DEPTH_PASS, Frustum(lightSpaceMatrix));
+		// 2. render
+		beginPass_hw7(LIT_PASS);
+		or_shader->use();
+		glState().activeTexture(GL_TEXTURE0);
+		glState().bindTexture(GL_TEXTURE_2D, textureLoader().texture(boxTexture));
+		glState().activeTexture(GL_TEXTURE1);
+		glState().bindTexture(GL_TEXTURE_2D, depthMap);
+		RenderScenePooled(LIT_PASS, Frustum(projection * view));
+	}
+	else
+	{
+		// 1. depth mapping
+		DrawCommand depthCommand = { simpleDepthShader->ID, { 0, 0 }, 0, false, 0.0f };
+		RenderScene(DEPTH_PASS, depthCommand, lightPos, Frustum(lightSpaceMatrix));
+		// 2. render
+		DrawCommand litCommand = { or_shader->ID, { textureLoader().texture(boxTexture), depthMap }, 0, false, 0.0f };
+		RenderScene(LIT_PASS, litCommand, camera.Position, Frustum(projection * view));
+		renderQueue().execute(beginPass_hw7);
+	}
+	// the camera's depth buffer is still bound: test the boxes against it for the next frames
+	if (occlusionCulling)
+		occlusion.query(projection * view, camera.Position, 0.1f, cubeBoxes);
 
 	// 3. visualize depth map by rendering it to plane
 	/*
@@ -419,3 +659,40 @@ void render_hw7()
 	glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
 	*/
 }
+
+void shutdown_hw7()
+{
+	delete simpleDepthShader;
+	delete or_shader;
+	simpleDepthShader = or_shader = NULL;
+	glDeleteFramebuffers(1, &depthMapFBO);
+	glDeleteTextures(1, &depthMap);
+	depthMapFBO = depthMap = 0;
+	// a decode still in flight is dropped when it arrives
+	if (boxTexture != 0)
+		textureLoader().release(boxTexture);
+	boxTexture = 0;
+	if (cube != 0)
+		meshRegistry().release(cube);
+	if (shadowCube != 0)
+		meshRegistry().release(shadowCube);
+	if (plane != 0)
+		meshRegistry().release(plane);
+	if (modelMesh != 0)
+		meshRegistry().release(modelMesh);
+	cube = shadowCube = plane = modelMesh = 0;
+	cubeInstances.clear();
+	cubeBoxes.clear();
+	scenePool.release();
+	occlusion.release();
+	// the textures may still be bound in the state cache
+	glState().invalidate();
+}
+
+GLsizeiptr gpuBytes_hw7()
+{
+	GLsizeiptr bytes = meshRegistry().gpuBytes(cube) + meshRegistry().gpuBytes(shadowCube) + meshRegistry().gpuBytes(plane) + meshRegistry().gpuBytes(modelMesh) + scenePool.gpuBytes() + textureLoader().gpuBytes(boxTexture);
+	if (depthMap != 0)
+		bytes += (GLsizeiptr)SHADOW_WIDTH * SHADOW_HEIGHT * 4;
+	return bytes;
+}
@@ -1,5 +1,6 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -7,14 +8,47 @@
 
 #include "hw.h"
 #include "shader.h"
+#include "bezier.h"
+#include "pointgrid.h"
+#include "nurbs.h"
+#include "strokecapture.h"
+#include "mesh.h"
+#include "streambuffer.h"
 
 #include <iostream>
 #include <algorithm>
-#include <deque>
+#include <vector>
+#include <string>
 
-static std::deque<std::pair<float, float> > controlVec;
+static std::vector<glm::vec2> controlVec;
+static std::vector<float> controlWeights;
+static ArcLengthTable arcTable;
+// length of the curve on screen, of whichever kind it is
+static float curveLength = 0.0f;
+static RationalBezier rationalCurve;
+static NurbsCurve nurbsCurve;
+static PointGrid controlGrid;
+static int hoverPoint = -1, selectedPoint = -1;
+static bool dragging = false;
 static bool flush = false;
 
+static StrokeCapture strokeCapture;
+static std::vector<FittedStroke> strokes;
+static bool strokeMode = false, stroking = false;
+
+const float PICK_RADIUS = 0.03f;
+
+enum CurveType {
+	CURVE_BEZIER,
+	CURVE_RATIONAL,
+	CURVE_NURBS
+};
+
+glm::vec2 cursorToNDC(double x, double y)
+{
+	return glm::vec2(2 * x / (double)SCR_WIDTH - 1, 1 - 2 * y / (double)SCR_HEIGHT);
+}
+
 int factorial(int x) {
 	int ans = 1;
 	for (size_t i = 1; i <= x; i++) {
@@ -23,69 +57,237 @@ int factorial(int x) {
 	return ans;
 }
 
+// The original curve loop with run-time factorials and pow, kept as the benchmark baseline
+glm::vec2 bezierFactorial(const std::vector<glm::vec2> &points, float t)
+{
+	int n = (int)points.size() - 1;
+	float x = 0, y = 0;
+	for (int j = 0; j <= n; j++)
+	{
+		float proportion = factorial(n) / (factorial(j)*factorial(n - j))*pow(t, j)*pow(1 - t, n - j);
+		x += points[j].x*proportion;
+		y += points[j].y*proportion;
+	}
+	return glm::vec2(x, y);
+}
+
+// time per sample of each curve kernel, filled by runKernelBenchmark
+struct KernelTiming {
+	std::string name;
+	double nsPerSample;
+	double speedup;
+};
+static std::vector<KernelTiming> kernelTimings;
+
+void runKernelBenchmark()
+{
+	const int samples = 200000;
+	std::vector<glm::vec2> points = controlVec;
+	std::vector<float> weights = controlWeights;
+	if (points.size() < 2)
+	{
+		points = { glm::vec2(-0.8f, -0.5f), glm::vec2(-0.3f, 0.8f), glm::vec2(0.4f, 0.8f), glm::vec2(0.8f, -0.5f) };
+		weights.assign(points.size(), 1.0f);
+	}
+	int n = (int)points.size() - 1;
+	RationalBezier rational;
+	rational.points = points;
+	rational.weights = weights;
+	NurbsCurve nurbs;
+	nurbs.degree = std::min(3, n);
+	nurbs.points = points;
+	nurbs.weights = weights;
+	nurbs.knots = NurbsCurve::clampedKnots((int)points.size(), nurbs.degree);
+
+	std::vector<float> params(samples), outX(samples), outY(samples);
+	std::vector<glm::vec2> out(samples);
+	for (int i = 0; i < samples; i++)
+		params[i] = (float)i / (float)samples;
+	volatile float sink = 0.0f;
+
+	kernelTimings.clear();
+	double start;
+	auto record = [&](const std::string &name) {
+		kernelTimings.push_back({ name, (glfwGetTime() - start) * 1e9 / samples, 0.0 });
+		sink = sink + outX[samples / 2] + out[samples / 2].x;
+	};
+
+	// the polynomial kernels at the common low degrees and at the degree of the current curve
+	std::vector<std::vector<glm::vec2> > curves;
+	for (int degree = 2; degree <= 3; degree++)
+	{
+		curves.push_back(std::vector<glm::vec2>());
+		for (int i = 0; i <= degree; i++)
+			curves.back().push_back(glm::vec2(std::cos(i * 1.3f), std::sin(i * 2.1f)));
+	}
+	if (n != 2 && n != 3)
+	{
+		curves.push_back(points);
+	}
+	for (size_t c = 0; c < curves.size(); c++)
+	{
+		const std::vector<glm::vec2> &curve = curves[c];
+		std::string degree = "degree " + std::to_string(curve.size() - 1) + ", ";
+
+		start = glfwGetTime();
+		for (int i = 0; i < samples; i++)
+			out[i] = bezierFactorial(curve, params[i]);
+		record(degree + "factorial/pow");
+
+		start = glfwGetTime();
+		for (int i = 0; i < samples; i++)
+			out[i] = bezierPoint(curve, params[i]);
+		record(degree + "Horner");
+
+		start = glfwGetTime();
+		evaluateBezier(curve.data(), (int)curve.size(), params.data(), samples, out.data());
+		record(degree + ((int)curve.size() - 1 <= MAX_SPECIALIZED_DEGREE ? "specialized" : "fallback"));
+
+		// speedup of Horner and of the specialized kernel over the factorial/pow loop
+		size_t base = kernelTimings.size() - 3;
+		for (size_t i = base + 1; i < kernelTimings.size(); i++)
+			kernelTimings[i].speedup = kernelTimings[base].nsPerSample / kernelTimings[i].nsPerSample;
+	}
+
+	start = glfwGetTime();
+	for (int i = 0; i < samples; i++)
+	{
+		glm::vec2 p = rational.evaluate(params[i]);
+		outX[i] = p.x;
+		outY[i] = p.y;
+	}
+	record("rational, scalar");
+
+	start = glfwGetTime();
+	rational.evaluate(params.data(), samples, outX.data(), outY.data());
+	record("rational, batch");
+
+	start = glfwGetTime();
+	for (int i = 0; i < samples; i++)
+	{
+		glm::vec2 p = nurbs.evaluate(params[i]);
+		outX[i] = p.x;
+		outY[i] = p.y;
+	}
+	record("NURBS, scalar");
+
+	start = glfwGetTime();
+	nurbs.evaluate(params.data(), samples, outX.data(), outY.data());
+	record("NURBS, batch");
+}
+
+// Appends a line strip through every cubic segment of a fitted chain
+void tessellateChain(const std::vector<glm::vec2> &chain, std::vector<float> &vertices)
+{
+	const int steps = 16;
+	for (size_t k = 0; k + 3 < chain.size(); k += 3)
+	{
+		for (int i = k == 0 ? 0 : 1; i <= steps; i++)
+		{
+			glm::vec2 p = BezierEvaluator<3>::evaluate(&chain[k], (float)i / (float)steps);
+			vertices.push_back(p.x);
+			vertices.push_back(p.y);
+		}
+	}
+}
+
+// compiled in the background by init_hw8; the meshes are made on first render, the stroke
+// meshes again from the fitted strokes after a shutdown. All are freed by shutdown_hw8
+static Shader *curveShader;
+static Uniform<glm::vec3> color;
+static Uniform<glm::vec2> offset;
+static Uniform<float> scale;
+static MeshHandle quad, curveMesh, previewMesh;
+static std::vector<MeshHandle> strokeMeshes;
+static GLuint polylineLayout;
+
+// Draws a square around every point and the polyline through them. The quad is a persistent
+// unit mesh placed by the offset and scale uniforms; only the polyline is streamed per call.
 void draw(float *vertices, float radius, int sizeOfVec) {
+	static float quadVec[8] = {
+		1.0f, 1.0f,
+		1.0f, -1.0f,
+		-1.0f, 1.0f,
+		-1.0f, -1.0f
+	};
+	static unsigned int quadIndices[6] = {
+		0, 1, 2,
+		1, 2, 3
+	};
+	if (quad == 0)
+		quad = meshRegistry().create(quadVec, sizeof(quadVec), quadIndices, sizeof(quadIndices), 2, { { 0, 2, 0 } });
+	if (polylineLayout == 0)
+		polylineLayout = streamBuffer().createLayout(2, { { 0, 2, 0 } });
+
+	scale.set(radius);
 	for (size_t i = 0; i < sizeOfVec; i++)
 	{
-		float vec[8];
-		// 
-		vec[0] = vertices[2 * i] + radius;
-		vec[1] = vertices[2 * i + 1] + radius;
-		// 
-		vec[2] = vertices[2 * i] + radius;
-		vec[3] = vertices[2 * i + 1] - radius;
-		// 
-		vec[4] = vertices[2 * i] - radius;
-		vec[5] = vertices[2 * i + 1] + radius;
-		// 
-		vec[6] = vertices[2 * i] - radius;
-		vec[7] = vertices[2 * i + 1] - radius;
-		unsigned int indices[6] = {
-			0, 1, 2,
-			1, 2, 3
-		};
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vec), vec, GL_DYNAMIC_DRAW);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
-		glEnableVertexAttribArray(0);
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-		if (i != 0)
-		{
-			float lineVec[4];
-			// ǰ
-			lineVec[0] = vertices[2 * (i - 1)];
-			lineVec[1] = vertices[2 * (i - 1) + 1];
-			// ǰ
-			lineVec[2] = vertices[2 * i];
-			lineVec[3] = vertices[2 * i + 1];
-			glBufferData(GL_ARRAY_BUFFER, sizeof(lineVec), lineVec, GL_DYNAMIC_DRAW);
-			glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
-			glEnableVertexAttribArray(0);
-			glDrawArrays(GL_LINES, 0, 2);
-		}
+		offset.set(glm::vec2(vertices[2 * i], vertices[2 * i + 1]));
+		meshRegistry().get(quad).draw();
+	}
+	scale.set(1.0f);
+	offset.set(glm::vec2(0.0f));
+	if (sizeOfVec > 1)
+	{
+		GLint first = streamBuffer().upload(vertices, 2 * sizeOfVec * sizeof(float), 2);
+		glState().bindVertexArray(polylineLayout);
+		glDrawArrays(GL_LINE_STRIP, first, sizeOfVec);
 	}
 }
 
-void render_hw8()
+bool init_hw8()
 {
 	//shader code
 	static const char *shader_vs = "#version 330 core\n"
 		"layout (location = 0) in vec2 aPos;\n"
+		"uniform vec2 offset;\n"
+		"uniform float scale;\n"
 		"void main()\n"
 		"{\n"
-		"   gl_Position = vec4(aPos, 0.0f, 1.0f);\n"
+		"   gl_Position = vec4(aPos * scale + offset, 0.0f, 1.0f);\n"
 		"}\0";
 
 	static const char *shader_fs = "#version 330 core\n"
 		"out vec4 FragColor;\n"
+		"uniform vec3 color;\n"
 		"void main()\n"
 		"{\n"
-		"   FragColor = vec4(1.0f, 1.0f, 1.0f, 1.0f);\n"
+		"   FragColor = vec4(color, 1.0f);\n"
 		"}\n\0";
+	if (curveShader == NULL)
+		curveShader = new Shader(shader_vs, shader_fs, nullptr, true);
+	if (!curveShader->ready())
+		return false;
+	// looked up once per program, again if it is rebuilt after a shutdown
+	color = curveShader->uniform<glm::vec3>("color");
+	offset = curveShader->uniform<glm::vec2>("offset");
+	scale = curveShader->uniform<float>("scale");
+	return true;
+}
+
+// the mouse edits the curve while this module is shown; hw5 may have taken the cursor meanwhile
+void update_hw8(GLFWwindow *window)
+{
+	glfwSetMouseButtonCallback(window, mousebutton_callback);
+	glfwSetCursorPosCallback(window, cursorpos_callback);
+}
+
+void render_hw8()
+{
 	// set up vertex data (and buffer(s)) and configure vertex attributes
 	// ------------------------------------------------------------------
 	static float curveVec[2000];
+	static float curveParams[1000], curveX[1000], curveY[1000];
+	static glm::vec2 curvePoints[1000];
 	static float *sideVec;
-	static Shader shader(shader_vs, shader_fs);
+
+	static bool constantSpeed = true;
+	static int curveType = CURVE_BEZIER;
+	static int nurbsDegree = 3;
+	static float strokeTolerance = 0.005f;
+	static std::vector<float> strokeVertices;
+	static std::vector<glm::vec2> previewChain;
+	static int previewVersion = 0;
 
 	float time = (float)glfwGetTime() / 5;
 	float t = time - floor(time);
@@ -93,58 +295,197 @@ void render_hw8()
 	int sizeOfControlVec = controlVec.size();
 	int curveSize = 1000;
 
-	unsigned int VAO;
-	glGenVertexArrays(1, &VAO);
+	if (curveMesh == 0)
+	{
+		previewMesh = meshRegistry().createDynamic(2, { { 0, 2, 0 } });
+		curveMesh = meshRegistry().create(curveVec, sizeof(curveVec), NULL, 0, 2, { { 0, 2, 0 } }, GL_DYNAMIC_DRAW);
+	}
+
+	{
+		ImGui::Begin("Bezier Curve");
+
+		flush |= ImGui::RadioButton("Bezier", &curveType, CURVE_BEZIER);
+		ImGui::SameLine();
+		flush |= ImGui::RadioButton("Rational", &curveType, CURVE_RATIONAL);
+		ImGui::SameLine();
+		flush |= ImGui::RadioButton("NURBS", &curveType, CURVE_NURBS);
+		if (curveType == CURVE_BEZIER && ImGui::Checkbox("constant speed", &constantSpeed))
+		{
+			flush = true;
+		}
+		if (curveType == CURVE_NURBS && ImGui::SliderInt("degree", &nurbsDegree, 1, NurbsCurve::MAX_DEGREE))
+		{
+			nurbsCurve.knots.clear();
+			flush = true;
+		}
+		if (ImGui::Button("exact circle"))
+		{
+			// a quadratic NURBS circle, which the polynomial curve cannot represent
+			NurbsCurve circle = NurbsCurve::circle(glm::vec2(0.0f), 0.5f);
+			controlVec = circle.points;
+			controlWeights = circle.weights;
+			nurbsCurve.knots = circle.knots;
+			controlGrid.clear();
+			for (size_t i = 0; i < controlVec.size(); i++)
+				controlGrid.insert((int)i, controlVec[i]);
+			hoverPoint = selectedPoint = -1;
+			curveType = CURVE_NURBS;
+			nurbsDegree = circle.degree;
+			sizeOfControlVec = controlVec.size();
+			flush = true;
+		}
+		ImGui::Text("control points: %d, length: %.3f", sizeOfControlVec, curveLength);
+		if (selectedPoint >= 0)
+		{
+			ImGui::Text("selected: #%d (%.3f, %.3f)", selectedPoint, controlVec[selectedPoint].x, controlVec[selectedPoint].y);
+			if (curveType != CURVE_BEZIER && ImGui::SliderFloat("weight", &controlWeights[selectedPoint], 0.1f, 10.0f))
+			{
+				flush = true;
+			}
+		}
+		ImGui::Separator();
+		ImGui::Checkbox("freehand stroke", &strokeMode);
+		if (ImGui::SliderFloat("tolerance", &strokeTolerance, 0.001f, 0.05f))
+		{
+			strokeCapture.setTolerance(strokeTolerance);
+		}
+		if (ImGui::Button("clear strokes"))
+		{
+			strokes.clear();
+			for (size_t i = 0; i < strokeMeshes.size(); i++)
+				meshRegistry().release(strokeMeshes[i]);
+			strokeMeshes.clear();
+		}
+		int rawSamples = 0, segments = 0;
+		for (size_t i = 0; i < strokes.size(); i++)
+		{
+			rawSamples += strokes[i].samples;
+			segments += (int)(strokes[i].chain.size() - 1) / 3;
+		}
+		ImGui::Text("strokes: %d, %d samples -> %d segments", (int)strokes.size(), rawSamples, segments);
+		if (strokeCapture.droppedSamples() > 0)
+		{
+			ImGui::Text("dropped samples: %d", strokeCapture.droppedSamples());
+		}
 
-	unsigned int VBO;
-	glGenBuffers(1, &VBO);
+		ImGui::Separator();
+		if (ImGui::Button("run kernel benchmark"))
+		{
+			runKernelBenchmark();
+		}
+		for (size_t i = 0; i < kernelTimings.size(); i++)
+		{
+			if (kernelTimings[i].speedup > 0.0)
+			{
+				ImGui::Text("%-28s %8.1f ns/sample (x%.1f)", kernelTimings[i].name.c_str(), kernelTimings[i].nsPerSample, kernelTimings[i].speedup);
+			}
+			else
+			{
+				ImGui::Text("%-28s %8.1f ns/sample", kernelTimings[i].name.c_str(), kernelTimings[i].nsPerSample);
+			}
+		}
 
-	unsigned int EBO;
-	glGenBuffers(1, &EBO);
+		ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+		ImGui::End();
+	}
 
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT);
 	glClear(GL_DEPTH_BUFFER_BIT);
 
-	glUseProgram(shader.ID);
+	glState().useProgram(curveShader->ID);
+	color.set(glm::vec3(1.0f, 1.0f, 1.0f));
+	offset.set(glm::vec2(0.0f));
+	scale.set(1.0f);
 
-	glBindVertexArray(VAO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	// the curve is only re-uploaded when it was re-evaluated
+	bool curveChanged = flush;
+	if (flush && curveType != CURVE_BEZIER)
+	{
+		rationalCurve.points = controlVec;
+		rationalCurve.weights = controlWeights;
+		nurbsCurve.points = controlVec;
+		nurbsCurve.weights = controlWeights;
+		nurbsCurve.degree = std::max(1, std::min(nurbsDegree, sizeOfControlVec - 1));
+		if (nurbsCurve.knots.size() != controlVec.size() + nurbsCurve.degree + 1)
+		{
+			nurbsCurve.knots = NurbsCurve::clampedKnots(sizeOfControlVec, nurbsCurve.degree);
+		}
+		for (size_t i = 0; i < curveSize; i++)
+		{
+			curveParams[i] = (float)i / (float)curveSize;
+		}
+		// batch evaluation writes separate x and y arrays
+		if (curveType == CURVE_RATIONAL)
+		{
+			rationalCurve.evaluate(curveParams, curveSize, curveX, curveY);
+		}
+		else
+		{
+			nurbsCurve.evaluate(curveParams, curveSize, curveX, curveY);
+		}
+		for (size_t i = 0; i < curveSize; i++)
+		{
+			curveVec[2 * i] = curveX[i];
+			curveVec[2 * i + 1] = curveY[i];
+		}
+		// the arc-length table only knows polynomial curves, so the length sums the chords of the
+		// samples, closed with the one to the curve's end
+		glm::vec2 last = curveType == CURVE_RATIONAL ? rationalCurve.evaluate(1.0f) : nurbsCurve.evaluate(1.0f);
+		curveLength = glm::length(last - glm::vec2(curveX[curveSize - 1], curveY[curveSize - 1]));
+		for (int i = 1; i < curveSize; i++)
+		{
+			curveLength += glm::length(glm::vec2(curveX[i] - curveX[i - 1], curveY[i] - curveY[i - 1]));
+		}
+		flush = false;
+	}
 
 	if (flush)
 	{
+		// the arc-length table only changes with the control points, so rebuild it here
+		arcTable.build(controlVec);
+		curveLength = arcTable.length();
 		for (size_t i = 0; i < curveSize; i++)
 		{
-			float tempt = (float)i / (float)curveSize;
-			float x = 0, y = 0;
-			for (size_t j = 0; j < sizeOfControlVec; j++)
+			curveParams[i] = (float)i / (float)curveSize;
+			if (constantSpeed)
 			{
-				int n = sizeOfControlVec - 1;
-				float proportion = factorial(n) / (factorial(j)*factorial(n - j))*pow(tempt, j)*pow(1 - tempt, n - j);
-				x += controlVec[j].first*proportion;
-				y += controlVec[j].second*proportion;
+				curveParams[i] = arcTable.parameterAtFraction(curveParams[i]);
 			}
-			curveVec[2 * i] = x;
-			curveVec[2 * i + 1] = y;
+		}
+		// dispatches once to the evaluator specialized for this degree
+		evaluateBezier(controlVec.data(), sizeOfControlVec, curveParams, curveSize, curvePoints);
+		for (size_t i = 0; i < curveSize; i++)
+		{
+			curveVec[2 * i] = curvePoints[i].x;
+			curveVec[2 * i + 1] = curvePoints[i].y;
 		}
 		flush = false;
 	}
 
-	glBufferData(GL_ARRAY_BUFFER, sizeof(curveVec), curveVec, GL_DYNAMIC_DRAW);
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	glDrawArrays(GL_POINTS, 0, curveSize);
+	if (constantSpeed && curveType == CURVE_BEZIER)
+	{
+		// move the construction point at constant speed along the curve
+		t = arcTable.parameterAtFraction(t);
+	}
 
-	for (size_t i = 0; i < sizeOfControlVec; i++)
+	if (curveChanged)
+	{
+		meshRegistry().update(curveMesh, curveVec, sizeof(curveVec));
+	}
+	meshRegistry().get(curveMesh).draw(GL_POINTS);
+
+	// rational curves only show their control polygon, not the de Casteljau construction
+	int levels = curveType == CURVE_BEZIER ? sizeOfControlVec : std::min(sizeOfControlVec, 1);
+	for (size_t i = 0; i < levels; i++)
 	{
 		float *temp = new float[2 * (sizeOfControlVec - i)];
 		for (size_t j = 0; j < sizeOfControlVec - i; j++)
 		{
 			if (i == 0)
 			{
-				temp[2 * j] = controlVec[j].first;
-				temp[2 * j + 1] = controlVec[j].second;
+				temp[2 * j] = controlVec[j].x;
+				temp[2 * j + 1] = controlVec[j].y;
 			}
 			else
 			{
@@ -157,30 +498,163 @@ void render_hw8()
 		sideVec = temp;
 	}
 
-	//unbind
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
+	if (curveType != CURVE_BEZIER && sizeOfControlVec > 0)
+	{
+		glm::vec2 point = curveType == CURVE_RATIONAL ? rationalCurve.evaluate(t) : nurbsCurve.evaluate(t);
+		draw(&point.x, radius, 1);
+	}
+
+	// freehand strokes are tessellated and uploaded once, when their fit arrives from the worker
+	// thread, or again after a shutdown released their meshes
+	strokeCapture.takeFinished(strokes);
+	for (size_t i = strokeMeshes.size(); i < strokes.size(); i++)
+	{
+		strokeVertices.clear();
+		tessellateChain(strokes[i].chain, strokeVertices);
+		strokeMeshes.push_back(meshRegistry().create(strokeVertices.data(), strokeVertices.size() * sizeof(float), NULL, 0, 2, { { 0, 2, 0 } }));
+	}
+	if (strokeCapture.preview(previewChain, previewVersion))
+	{
+		strokeVertices.clear();
+		tessellateChain(previewChain, strokeVertices);
+		meshRegistry().update(previewMesh, strokeVertices.data(), strokeVertices.size() * sizeof(float));
+	}
+	color.set(glm::vec3(0.4f, 0.8f, 1.0f));
+	for (size_t i = 0; i < strokeMeshes.size(); i++)
+	{
+		meshRegistry().get(strokeMeshes[i]).draw(GL_LINE_STRIP);
+	}
+	if (meshRegistry().get(previewMesh).vertexCount > 0)
+	{
+		meshRegistry().get(previewMesh).draw(GL_LINE_STRIP);
+	}
 
-	//delete
-	glDeleteBuffers(1, &VBO);
-	glDeleteBuffers(1, &EBO);
-	glDeleteVertexArrays(1, &VAO);
+	// highlight the hovered and selected control points
+	if (hoverPoint >= 0 && hoverPoint != selectedPoint)
+	{
+		color.set(glm::vec3(1.0f, 1.0f, 0.0f));
+		draw(&controlVec[hoverPoint].x, 1.5f * radius, 1);
+	}
+	if (selectedPoint >= 0)
+	{
+		color.set(glm::vec3(1.0f, 0.3f, 0.3f));
+		draw(&controlVec[selectedPoint].x, 1.5f * radius, 1);
+	}
+}
+
+void shutdown_hw8()
+{
+	delete curveShader;
+	curveShader = NULL;
+	MeshHandle meshes[3] = { quad, curveMesh, previewMesh };
+	for (int i = 0; i < 3; i++)
+	{
+		if (meshes[i] != 0)
+			meshRegistry().release(meshes[i]);
+	}
+	quad = curveMesh = previewMesh = 0;
+	for (size_t i = 0; i < strokeMeshes.size(); i++)
+		meshRegistry().release(strokeMeshes[i]);
+	strokeMeshes.clear();
+	glDeleteVertexArrays(1, &polylineLayout);
+	polylineLayout = 0;
+	glState().invalidate();
+}
+
+GLsizeiptr gpuBytes_hw8()
+{
+	GLsizeiptr bytes = meshRegistry().gpuBytes(quad) + meshRegistry().gpuBytes(curveMesh) + meshRegistry().gpuBytes(previewMesh);
+	for (size_t i = 0; i < strokeMeshes.size(); i++)
+		bytes += meshRegistry().gpuBytes(strokeMeshes[i]);
+	return bytes;
 }
 
 void mousebutton_callback(GLFWwindow* window, int button, int action, int mods)
 {
+	// clicks on the imGui windows are not control points, but a stroke or drag still has to end
+	if (ImGui::GetIO().WantCaptureMouse && !stroking && !dragging)
+	{
+		return;
+	}
+
+	double x, y;
+	glfwGetCursorPos(window, &x, &y);
+	glm::vec2 position = cursorToNDC(x, y);
+
+	// in stroke mode the left button draws freehand strokes instead of editing control points
+	if (strokeMode && button == GLFW_MOUSE_BUTTON_LEFT)
+	{
+		if (action == GLFW_PRESS)
+		{
+			strokeCapture.begin(position);
+			stroking = true;
+		}
+		else if (action == GLFW_RELEASE && stroking)
+		{
+			strokeCapture.end(position);
+			stroking = false;
+		}
+		return;
+	}
+
 	// mouse button
+	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+	{
+		// pressing on an existing point selects it and starts dragging
+		selectedPoint = controlGrid.nearest(controlVec, position, PICK_RADIUS);
+		dragging = selectedPoint >= 0;
+	}
+
 	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE)
 	{
-		double x, y;
-		glfwGetCursorPos(window, &x, &y);
-		controlVec.push_back(std::pair<float, float>(2 * x / (double)SCR_WIDTH - 1, 1 - 2 * y / (double)SCR_HEIGHT));
+		if (dragging)
+		{
+			dragging = false;
+		}
+		else
+		{
+			controlGrid.insert((int)controlVec.size(), position);
+			controlVec.push_back(position);
+			controlWeights.push_back(1.0f);
+		}
 	}
 
-	if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_RELEASE)
+	if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_RELEASE && !controlVec.empty())
 	{
+		int last = (int)controlVec.size() - 1;
+		controlGrid.remove(last, controlVec[last]);
 		controlVec.pop_back();
+		controlWeights.pop_back();
+		if (hoverPoint == last)
+			hoverPoint = -1;
+		if (selectedPoint == last)
+		{
+			selectedPoint = -1;
+			dragging = false;
+		}
 	}
 	flush = true;
+}
+
+void cursorpos_callback(GLFWwindow* /*window*/, double xpos, double ypos)
+{
+	glm::vec2 position = cursorToNDC(xpos, ypos);
+
+	if (stroking)
+	{
+		strokeCapture.addSample(position);
+		return;
+	}
+
+	if (dragging && selectedPoint >= 0)
+	{
+		controlGrid.move(selectedPoint, controlVec[selectedPoint], position);
+		controlVec[selectedPoint] = position;
+		hoverPoint = selectedPoint;
+		flush = true;
+		return;
+	}
+
+	// hover highlighting only looks at the grid cells around the cursor
+	hoverPoint = controlGrid.nearest(controlVec, position, PICK_RADIUS);
 }
\ No newline at end of file
@@ -0,0 +1,307 @@
+#ifndef LOOSEOCTREE_H
+#define LOOSEOCTREE_H
+
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+
+// Octree whose nodes hold objects within twice their cell, so an object's node follows from its
+// center and size alone: the deepest level whose cell is at least as large as the object, and the
+// cell its center falls in. Inserting, moving and removing an object therefore take a fixed
+// number of steps, which suits scenes where everything moves every frame. Only nodes with
+// objects below them exist; they are kept in a hash map by level and cell. Objects outside the
+// world stay in the root, which is never culled as a whole.
+class LooseOctree
+{
+public:
+	// node keys hold the level in 4 bits and each cell coordinate in 20
+	static const int MAX_DEPTH = 15;
+
+	LooseOctree(const glm::vec3 &center, float halfSize, int maxDepth = 6)
+		: center(center), halfSize(halfSize), maxDepth(std::min(maxDepth, MAX_DEPTH)), relinks(0), testedNodes(0)
+	{
+	}
+
+	void clear()
+	{
+		nodes.clear();
+		objects.clear();
+		freeIds.clear();
+		relinks = 0;
+	}
+
+	// Returns the id the object is moved, removed and reported with
+	unsigned int insert(const Bounds &bounds)
+	{
+		unsigned int id;
+		if (!freeIds.empty())
+		{
+			id = freeIds.back();
+			freeIds.pop_back();
+		}
+		else
+		{
+			id = (unsigned int)objects.size();
+			objects.push_back(Object());
+		}
+		objects[id].bounds = bounds;
+		link(id, keyOf(bounds));
+		return id;
+	}
+
+	// Only relinks the object when it lands in another node
+	void move(unsigned int id, const Bounds &bounds)
+	{
+		Object &object = objects[id];
+		object.bounds = bounds;
+		unsigned long long key = keyOf(bounds);
+		if (key == object.node)
+			return;
+		unlink(id);
+		link(id, key);
+		relinks++;
+	}
+
+	void remove(unsigned int id)
+	{
+		unlink(id);
+		freeIds.push_back(id);
+	}
+
+	// Appends the objects whose boxes are inside the frustum
+	void cull(const Frustum &frustum, std::vector<unsigned int> &visible)
+	{
+		testedNodes = 0;
+		if (!nodes.empty())
+			cullNode(key(0, 0, 0, 0), frustum, false, visible);
+	}
+
+	// The object whose box the ray hits first, -1 if none; distance is along direction
+	int pick(const glm::vec3 &origin, const glm::vec3 &direction, float &distance)
+	{
+		testedNodes = 0;
+		int hit = -1;
+		distance = 1e30f;
+		if (!nodes.empty())
+			pickNode(key(0, 0, 0, 0), origin, glm::vec3(1.0f) / direction, hit, distance);
+		return hit;
+	}
+
+	int objectCount() const
+	{
+		return (int)(objects.size() - freeIds.size());
+	}
+
+	int nodeCount() const
+	{
+		return (int)nodes.size();
+	}
+
+	// Nodes tested by the last query
+	int tested() const
+	{
+		return testedNodes;
+	}
+
+	// Moves that changed the object's node, since the octree was made or cleared
+	int relinked() const
+	{
+		return relinks;
+	}
+
+private:
+	struct Object
+	{
+		Bounds bounds;
+		unsigned long long node;
+		// index in the node's object list
+		unsigned int slot;
+		Object() : node(0), slot(0) {}
+	};
+
+	struct Node
+	{
+		std::vector<unsigned int> objects;
+		// objects in this node and below it
+		int count;
+		Node() : count(0) {}
+	};
+
+	glm::vec3 center;
+	float halfSize;
+	int maxDepth;
+	std::unordered_map<unsigned long long, Node> nodes;
+	std::vector<Object> objects;
+	std::vector<unsigned int> freeIds;
+	int relinks, testedNodes;
+
+	static unsigned long long key(int level, unsigned int x, unsigned int y, unsigned int z)
+	{
+		return ((unsigned long long)level << 60) | ((unsigned long long)x << 40) | ((unsigned long long)y << 20) | z;
+	}
+
+	static int levelOf(unsigned long long node)
+	{
+		return (int)(node >> 60);
+	}
+
+	static unsigned int cellOf(unsigned long long node, int axis)
+	{
+		return (unsigned int)(node >> (40 - 20 * axis)) & 0xFFFFF;
+	}
+
+	static unsigned long long parentOf(unsigned long long node)
+	{
+		return key(levelOf(node) - 1, cellOf(node, 0) >> 1, cellOf(node, 1) >> 1, cellOf(node, 2) >> 1);
+	}
+
+	unsigned long long keyOf(const Bounds &bounds) const
+	{
+		glm::vec3 extent = (bounds.max - bounds.min) * 0.5f;
+		float size = std::max(extent.x, std::max(extent.y, extent.z));
+		// cell half size at level L is halfSize / 2^L, which must hold the object's half size
+		int level = size > 0.0f ? (int)std::floor(std::log2(halfSize / size)) : maxDepth;
+		level = std::max(0, std::min(level, maxDepth));
+		glm::vec3 position = ((bounds.min + bounds.max) * 0.5f - center + halfSize) / (2.0f * halfSize);
+		unsigned int cells = 1u << level;
+		unsigned int cell[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float scaled = position[axis] * cells;
+			if (!(scaled >= 0.0f && scaled < (float)cells))
+				return key(0, 0, 0, 0);
+			cell[axis] = std::min((unsigned int)scaled, cells - 1);
+		}
+		return key(level, cell[0], cell[1], cell[2]);
+	}
+
+	// Loose box of a node: its cell grown by half a cell on every side
+	Bounds looseBounds(unsigned long long node) const
+	{
+		float cellSize = 2.0f * halfSize / (float)(1u << levelOf(node));
+		glm::vec3 low = center - halfSize + glm::vec3((float)cellOf(node, 0), (float)cellOf(node, 1), (float)cellOf(node, 2)) * cellSize;
+		Bounds bounds = { low - 0.5f * cellSize, low + 1.5f * cellSize };
+		return bounds;
+	}
+
+	void link(unsigned int id, unsigned long long node)
+	{
+		Node &target = nodes[node];
+		objects[id].node = node;
+		objects[id].slot = (unsigned int)target.objects.size();
+		target.objects.push_back(id);
+		for (unsigned long long k = node;; k = parentOf(k))
+		{
+			nodes[k].count++;
+			if (levelOf(k) == 0)
+				break;
+		}
+	}
+
+	void unlink(unsigned int id)
+	{
+		const Object &object = objects[id];
+		Node &source = nodes[object.node];
+		// swap with the last object of the node
+		unsigned int last = source.objects.back();
+		source.objects[object.slot] = last;
+		objects[last].slot = object.slot;
+		source.objects.pop_back();
+		for (unsigned long long k = object.node;; k = parentOf(k))
+		{
+			std::unordered_map<unsigned long long, Node>::iterator it = nodes.find(k);
+			if (--it->second.count == 0)
+				nodes.erase(it);
+			if (levelOf(k) == 0)
+				break;
+		}
+	}
+
+	// -1 outside, 1 inside, 0 crossing a plane
+	static int classify(const Bounds &box, const Frustum &frustum)
+	{
+		int result = 1;
+		for (int p = 0; p < 6; p++)
+		{
+			const glm::vec3 &n = frustum.normal[p];
+			glm::vec3 farCorner(n.x >= 0.0f ? box.max.x : box.min.x, n.y >= 0.0f ? box.max.y : box.min.y, n.z >= 0.0f ? box.max.z : box.min.z);
+			glm::vec3 nearCorner(n.x >= 0.0f ? box.min.x : box.max.x, n.y >= 0.0f ? box.min.y : box.max.y, n.z >= 0.0f ? box.min.z : box.max.z);
+			if (glm::dot(n, farCorner) + frustum.distance[p] < 0.0f)
+				return -1;
+			if (glm::dot(n, nearCorner) + frustum.distance[p] < 0.0f)
+				result = 0;
+		}
+		return result;
+	}
+
+	void cullNode(unsigned long long node, const Frustum &frustum, bool inside, std::vector<unsigned int> &visible)
+	{
+		std::unordered_map<unsigned long long, Node>::const_iterator it = nodes.find(node);
+		if (it == nodes.end())
+			return;
+		testedNodes++;
+		int level = levelOf(node);
+		// the root also holds the objects outside the world, so its box proves nothing
+		if (!inside && level > 0)
+		{
+			int side = classify(looseBounds(node), frustum);
+			if (side < 0)
+				return;
+			inside = side > 0;
+		}
+		const std::vector<unsigned int> &list = it->second.objects;
+		for (size_t i = 0; i < list.size(); i++)
+		{
+			if (inside || classify(objects[list[i]].bounds, frustum) >= 0)
+				visible.push_back(list[i]);
+		}
+		if (level == maxDepth || it->second.count == (int)list.size())
+			return;
+		unsigned int x = cellOf(node, 0) << 1, y = cellOf(node, 1) << 1, z = cellOf(node, 2) << 1;
+		for (int c = 0; c < 8; c++)
+			cullNode(key(level + 1, x | (c & 1), y | ((c >> 1) & 1), z | (c >> 2)), frustum, inside, visible);
+	}
+
+	// Slab test; the entry distance if the ray hits the box before limit, otherwise a negative number
+	static float intersect(const Bounds &box, const glm::vec3 &origin, const glm::vec3 &inverse, float limit)
+	{
+		glm::vec3 t0 = (box.min - origin) * inverse, t1 = (box.max - origin) * inverse;
+		glm::vec3 low = glm::min(t0, t1), high = glm::max(t0, t1);
+		float enter = std::max(std::max(low.x, low.y), std::max(low.z, 0.0f));
+		float leave = std::min(std::min(high.x, high.y), std::min(high.z, limit));
+		return enter <= leave ? enter : -1.0f;
+	}
+
+	void pickNode(unsigned long long node, const glm::vec3 &origin, const glm::vec3 &inverse, int &hit, float &distance)
+	{
+		std::unordered_map<unsigned long long, Node>::const_iterator it = nodes.find(node);
+		if (it == nodes.end())
+			return;
+		testedNodes++;
+		int level = levelOf(node);
+		if (level > 0 && intersect(looseBounds(node), origin, inverse, distance) < 0.0f)
+			return;
+		const std::vector<unsigned int> &list = it->second.objects;
+		for (size_t i = 0; i < list.size(); i++)
+		{
+			float t = intersect(objects[list[i]].bounds, origin, inverse, distance);
+			if (t >= 0.0f && t < distance)
+			{
+				distance = t;
+				hit = (int)list[i];
+			}
+		}
+		if (level == maxDepth || it->second.count == (int)list.size())
+			return;
+		unsigned int x = cellOf(node, 0) << 1, y = cellOf(node, 1) << 1, z = cellOf(node, 2) << 1;
+		for (int c = 0; c < 8; c++)
+			pickNode(key(level + 1, x | (c & 1), y | ((c >> 1) & 1), z | (c >> 2)), origin, inverse, hit, distance);
+	}
+};
+
+#endif
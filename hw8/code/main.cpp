@@ -7,6 +7,16 @@
 
 #include <iostream>
 #include "hw.h"
+#include "glstate.h"
+#include "mesh.h"
+#include "streambuffer.h"
+#include "programcache.h"
+#include "glextensions.h"
+#include "module.h"
+#include "textureloader.h"
+#include "meshcache.h"
+#include "renderqueue.h"
+#include "profiler.h"
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void processInput(GLFWwindow *window);
@@ -16,6 +26,9 @@ int main()
 	// glfw: initialize and configure
 	// ------------------------------
 	glfwInit();
+	double launchTime = glfwGetTime();
+	bool firstFrame = true, startupReported = false;
+	double firstFrameTime = 0.0;
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
@@ -39,6 +52,9 @@ int main()
 		std::cout << "Failed to initialize GLAD" << std::endl;
 		return -1;
 	}
+	// let the driver compile the modules' shaders on as many threads as it likes
+	if (glExtensions().parallelShaderCompile)
+		glExtensions().maxShaderCompilerThreads(0xFFFFFFFF);
 
 	//setup imGui context
 	IMGUI_CHECKVERSION();
@@ -56,11 +72,16 @@ int main()
 	window_flags |= ImGuiWindowFlags_NoTitleBar;
 	window_flags |= ImGuiWindowFlags_NoBackground;
 
-	unsigned int nowProgram = 0;
-	unsigned int hw2_Program = load_hw2();
-	unsigned int hw3_Program = load_hw3();
-	unsigned int hw4_Program = load_hw4();
-	unsigned int hw5_Program = load_hw5();
+	// nothing is loaded before the window shows; modules are prepared in the background
+	// once it does, and the one picked from the menu is shown as soon as it is ready
+	moduleRegistry().add({ "H W 2", "triangle", init_hw2, NULL, render_hw2, shutdown_hw2, gpuBytes_hw2 });
+	moduleRegistry().add({ "H W 3", "line", init_hw3, NULL, render_hw3, shutdown_hw3, gpuBytes_hw3 });
+	moduleRegistry().add({ "H W 4", "Cube", init_hw4, NULL, render_hw4, shutdown_hw4, gpuBytes_hw4 });
+	moduleRegistry().add({ "H W 5", "Camera", init_hw5, update_hw5, render_hw5, shutdown_hw5, gpuBytes_hw5 });
+	moduleRegistry().add({ "H W 6", "Light", init_hw6, NULL, render_hw6, shutdown_hw6, gpuBytes_hw6 });
+	moduleRegistry().add({ "H W 7", "Shadow", init_hw7, NULL, render_hw7, shutdown_hw7, gpuBytes_hw7 });
+	moduleRegistry().add({ "H W 8", "Bezier Curve", init_hw8, update_hw8, render_hw8, shutdown_hw8, gpuBytes_hw8 });
+	int budgetMB = (int)(moduleRegistry().budget() >> 20);
 	
 	// render loop
 	// -----------
@@ -87,71 +108,68 @@ int main()
 			{
 				if (ImGui::BeginMenu("File"))
 				{
-					if (ImGui::MenuItem("H W 2", "triangle"))
+					for (int i = 0; i < moduleRegistry().count(); i++)
 					{
-						nowProgram = 2;
-					}
-					if (ImGui::MenuItem("H W 3", "line"))
-					{
-						nowProgram = 3;
-					}
-					if (ImGui::MenuItem("H W 4", "Cube"))
-					{
-						nowProgram = 4;
-					}
-					if (ImGui::MenuItem("H W 5", "Camera"))
-					{
-						nowProgram = 5;
-					}
-					if (ImGui::MenuItem("H W 6", "Light"))
-					{
-						nowProgram = 6;
-					}
-					if (ImGui::MenuItem("H W 7", "Shadow"))
-					{
-						nowProgram = 7;
-					}
-					if (ImGui::MenuItem("H W 8", "Bezier Curve"))
-					{
-						nowProgram = 8;
-						glfwSetMouseButtonCallback(window, mousebutton_callback);
+						if (ImGui::MenuItem(moduleRegistry().get(i).label, moduleRegistry().get(i).hint))
+							moduleRegistry().request(i);
 					}
 					ImGui::MenuItem("...", "...");
 					
 					ImGui::EndMenu();
 				}
+				if (moduleRegistry().loading() >= 0)
+					ImGui::Text("loading %s...", moduleRegistry().get(moduleRegistry().loading()).label);
 				ImGui::EndMainMenuBar();
 			}
 		}
 
-		switch (nowProgram)
+		if (!firstFrame)
+			moduleRegistry().prepare();
+
+		glState().beginFrame();
+		profiler().beginFrame();
+		streamBuffer().beginFrame();
+		textureLoader().update();
+		if (moduleRegistry().shown() >= 0)
+		{
+			moduleRegistry().render(window);
+		}
+		else
 		{
-		case 2:
-			render_hw2(hw2_Program);
-			break;
-		case 3:
-			render_hw3(hw3_Program);
-			break;
-		case 4:
-			render_hw4(hw4_Program);
-			break;
-		case 5:
-			render_hw5(hw5_Program, window);
-			break;
-		case 6:
-			render_hw6();
-			break;
-		case 7:
-			render_hw7();
-			break;
-		case 8:
-			render_hw8();
-			break;
-		default:
 			ImGui::ShowDemoWindow();
 			glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 			glClear(GL_COLOR_BUFFER_BIT);
-			break;
+		}
+		streamBuffer().endFrame();
+
+		if (moduleRegistry().shown() >= 0)
+		{
+			ImGui::Begin("Statistics");
+			ImGui::Text("streamed: %.1f KB/frame, stalls: %d", streamBuffer().streamedBytes() / 1024.0f, streamBuffer().stalls());
+			ImGui::Text("GPU buffers: %.1f KB", (meshRegistry().gpuBytes() + streamBuffer().gpuBytes()) / 1024.0f);
+			ImGui::Text("textures: %.1f KB, %d loading, %.1f KB uploaded", textureLoader().gpuBytes() / 1024.0f, textureLoader().pendingTextures(), textureLoader().uploadedBytes() / 1024.0f);
+			ImGui::Text("texture cache: %d mapped, %d converted, %.1f ms", textureCache().cachedTextures(), textureCache().convertedTextures(), textureCache().milliseconds());
+			ImGui::Text("mesh cache: %d mapped, %d converted, %.1f ms", meshCache().cachedMeshes(), meshCache().convertedMeshes(), meshCache().milliseconds());
+			ImGui::Text("texture compression: %.1f KB saved", textureLoader().savedBytes() / 1024.0f);
+			for (int i = 1; i <= textureLoader().textureCount(); i++)
+			{
+				TextureLoader::TextureInfo info = textureLoader().info(i);
+				if (info.bytes > 0 && info.format != BLOCK_NONE)
+					ImGui::Text("  %s: %s, %.1f dB, %.1f of %.1f KB", info.path, blockFormatName(info.format), info.psnr, info.bytes / 1024.0f, info.rawBytes / 1024.0f);
+			}
+			ImGui::Text("GL state calls: %d issued, %d filtered", glState().issuedCalls(), glState().filteredCalls());
+			ImGui::Text("render queue: %d draws, %d program, %d texture, %d VAO switches (%d unsorted), %.3f ms sort", renderQueue().draws(),
+				renderQueue().programSwitches(), renderQueue().textureSwitches(), renderQueue().vertexArraySwitches(), renderQueue().unsortedSwitches(), renderQueue().sortMilliseconds());
+			ImGui::Text("programs: %d cached, %d compiled, %.1f ms", programCache().cachedPrograms(), programCache().compiledPrograms(), programCache().milliseconds());
+			ImGui::Text("modules: %d resident, %.1f KB, %d released", moduleRegistry().residentModules(), moduleRegistry().residentBytes() / 1024.0f, moduleRegistry().releasedModules());
+			if (ImGui::SliderInt("budget (MB)", &budgetMB, 0, 64))
+				moduleRegistry().setBudget((GLsizeiptr)budgetMB << 20);
+			for (int i = 0; i < profiler().count(); i++)
+			{
+				const Profiler::Section &section = profiler().section(i);
+				ImGui::Text("%s: %.3f ms, %.3f ms average, %d calls", section.name, section.milliseconds, section.average, section.calls);
+			}
+			ImGui::End();
 		}
 		
 		//render imGui
@@ -162,8 +180,27 @@ int main()
 		// -------------------------------------------------------------------------------
 		glfwSwapBuffers(window);
 		glfwPollEvents();
+
+		if (firstFrame)
+		{
+			// modules are prepared after this, so their programs no longer delay the first frame
+			firstFrameTime = glfwGetTime();
+			firstFrame = false;
+		}
+		else if (!startupReported && moduleRegistry().settled())
+		{
+			// a warm start loads every program binary from the cache, a cold one compiles them
+			std::cout << (programCache().compiledPrograms() == 0 ? "warm" : "cold") << " startup: "
+				<< (firstFrameTime - launchTime) * 1000.0 << " ms to first frame, "
+				<< (glfwGetTime() - launchTime) * 1000.0 << " ms until the modules were prepared, "
+				<< programCache().cachedPrograms() << " programs cached, " << programCache().compiledPrograms() << " compiled in "
+				<< programCache().milliseconds() << " ms" << std::endl;
+			startupReported = true;
+		}
 	}
 
+	moduleRegistry().shutdown();
+
 	// glfw: terminate, clearing all previously allocated GLFW resources.
 	// ------------------------------------------------------------------
 	ImGui_ImplOpenGL3_Shutdown();
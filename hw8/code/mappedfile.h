@@ -0,0 +1,111 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <cstddef>
+#include <sys/stat.h>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// A read-only file mapped into memory; pages are read from disk when they are touched and
+// can be dropped by the system again, so a mapped file does not add to the heap
+class MappedFile
+{
+public:
+	MappedFile() : bytes(NULL), length(0)
+	{
+#ifdef _WIN32
+		file = INVALID_HANDLE_VALUE;
+		mapping = NULL;
+#endif
+	}
+
+	~MappedFile()
+	{
+		close();
+	}
+
+	bool open(const std::string &path)
+	{
+		close();
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fileSize;
+		GetFileSizeEx(file, &fileSize);
+		length = (size_t)fileSize.QuadPart;
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping != NULL)
+			bytes = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat info;
+		if (fstat(fd, &info) == 0 && info.st_size > 0)
+		{
+			length = (size_t)info.st_size;
+			void *view = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (view != MAP_FAILED)
+				bytes = (const unsigned char *)view;
+		}
+		// the mapping keeps the file alive
+		::close(fd);
+#endif
+		if (bytes == NULL)
+			close();
+		return bytes != NULL;
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (bytes != NULL)
+			UnmapViewOfFile(bytes);
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+		mapping = NULL;
+#else
+		if (bytes != NULL)
+			munmap((void *)bytes, length);
+#endif
+		bytes = NULL;
+		length = 0;
+	}
+
+	const unsigned char *data() const
+	{
+		return bytes;
+	}
+
+	size_t size() const
+	{
+		return length;
+	}
+
+private:
+	const unsigned char *bytes;
+	size_t length;
+#ifdef _WIN32
+	HANDLE file, mapping;
+#endif
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+};
+
+#endif
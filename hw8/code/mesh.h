@@ -0,0 +1,234 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <glad/glad.h>
+
+#include "glstate.h"
+#include "meshoptimize.h"
+
+#include <vector>
+#include <initializer_list>
+
+// One float vertex attribute: shader location, component count and offset in floats
+struct VertexAttribute
+{
+	GLuint index;
+	GLint size;
+	GLsizei offset;
+};
+
+// GPU-resident geometry: a configured VAO with its vertex buffer, optional index buffer and
+// optional buffer of per-instance model matrices
+struct Mesh
+{
+	GLuint VAO, VBO, EBO, instanceVBO;
+	GLsizei stride;
+	GLsizei vertexCount, indexCount, instanceCount;
+	GLsizeiptr vertexBytes, indexBytes, instanceBytes;
+	GLenum usage;
+	// vertex cache miss ratio before and after createOptimized, 0 for other meshes
+	float acmrBefore, acmrAfter;
+
+	void bind() const
+	{
+		glState().bindVertexArray(VAO);
+	}
+
+	// draws the whole mesh, through the index buffer if it has one
+	void draw(GLenum mode = GL_TRIANGLES) const
+	{
+		glState().bindVertexArray(VAO);
+		if (EBO != 0)
+			glDrawElements(mode, indexCount, GL_UNSIGNED_INT, 0);
+		else
+			glDrawArrays(mode, 0, vertexCount);
+	}
+
+	// draws every instance set by MeshRegistry::setInstances in one call
+	void drawInstanced(GLenum mode = GL_TRIANGLES) const
+	{
+		glState().bindVertexArray(VAO);
+		if (EBO != 0)
+			glDrawElementsInstanced(mode, indexCount, GL_UNSIGNED_INT, 0, instanceCount);
+		else
+			glDrawArraysInstanced(mode, 0, vertexCount, instanceCount);
+	}
+};
+
+typedef unsigned int MeshHandle;
+
+// Owns every mesh of the program. Static geometry is uploaded once and its VAO is configured once,
+// so render functions only bind and draw. Dynamic meshes keep their buffers between frames and
+// re-specify storage only when the data outgrows it.
+class MeshRegistry
+{
+public:
+	// Creates a mesh from interleaved float vertices (stride in floats) and optional indices
+	MeshHandle create(const float *vertices, GLsizeiptr vertexBytes, const unsigned int *indices, GLsizeiptr indexBytes,
+		GLsizei stride, std::initializer_list<VertexAttribute> attributes, GLenum usage = GL_STATIC_DRAW)
+	{
+		Mesh mesh = Mesh();
+		mesh.stride = stride;
+		mesh.usage = usage;
+		mesh.vertexBytes = vertexBytes;
+		mesh.vertexCount = (GLsizei)(vertexBytes / (stride * sizeof(float)));
+		glGenVertexArrays(1, &mesh.VAO);
+		glGenBuffers(1, &mesh.VBO);
+		glState().bindVertexArray(mesh.VAO);
+		glState().bindBuffer(GL_ARRAY_BUFFER, mesh.VBO);
+		glBufferData(GL_ARRAY_BUFFER, vertexBytes, vertices, usage);
+		if (indices != NULL)
+		{
+			mesh.indexBytes = indexBytes;
+			mesh.indexCount = (GLsizei)(indexBytes / sizeof(unsigned int));
+			glGenBuffers(1, &mesh.EBO);
+			glState().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.EBO);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, indices, usage);
+		}
+		for (const VertexAttribute &attribute : attributes)
+		{
+			glVertexAttribPointer(attribute.index, attribute.size, GL_FLOAT, GL_FALSE, stride * sizeof(float), (void*)(attribute.offset * sizeof(float)));
+			glEnableVertexAttribArray(attribute.index);
+		}
+		glState().bindVertexArray(0);
+		glState().bindBuffer(GL_ARRAY_BUFFER, 0);
+		return store(mesh);
+	}
+
+	// Creates a static indexed triangle list like create, after reordering its triangles for the
+	// vertex cache and its vertices into the order the triangles first use them. Meshes whose
+	// vertices are updated later, or whose index order matters, go through create.
+	MeshHandle createOptimized(const float *vertices, GLsizeiptr vertexBytes, const unsigned int *indices, GLsizeiptr indexBytes,
+		GLsizei stride, std::initializer_list<VertexAttribute> attributes)
+	{
+		size_t vertexCount = vertexBytes / (stride * sizeof(float)), indexCount = indexBytes / sizeof(unsigned int);
+		std::vector<float> orderedVertices(vertices, vertices + vertexCount * stride);
+		std::vector<unsigned int> orderedIndices(indices, indices + indexCount);
+		float before = acmr(orderedIndices.data(), indexCount, vertexCount);
+		optimizeVertexCache(orderedIndices.data(), indexCount, vertexCount);
+		vertexCount = optimizeVertexFetch(orderedVertices.data(), vertexCount, orderedIndices.data(), indexCount, stride);
+		MeshHandle handle = create(orderedVertices.data(), (GLsizeiptr)(vertexCount * stride * sizeof(float)), orderedIndices.data(), indexBytes, stride, attributes);
+		meshes[handle - 1].acmrBefore = before;
+		meshes[handle - 1].acmrAfter = acmr(orderedIndices.data(), indexCount, vertexCount);
+		return handle;
+	}
+
+	// Creates an empty mesh for data that changes every frame
+	MeshHandle createDynamic(GLsizei stride, std::initializer_list<VertexAttribute> attributes)
+	{
+		return create(NULL, 0, NULL, 0, stride, attributes, GL_DYNAMIC_DRAW);
+	}
+
+	// Replaces the vertices of a mesh, growing its storage only when needed
+	void update(MeshHandle handle, const float *vertices, GLsizeiptr bytes)
+	{
+		Mesh &mesh = meshes[handle - 1];
+		glState().bindBuffer(GL_ARRAY_BUFFER, mesh.VBO);
+		if (bytes > mesh.vertexBytes)
+		{
+			glBufferData(GL_ARRAY_BUFFER, bytes, vertices, mesh.usage);
+			mesh.vertexBytes = bytes;
+		}
+		else
+		{
+			glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, vertices);
+		}
+		mesh.vertexCount = (GLsizei)(bytes / (mesh.stride * sizeof(float)));
+	}
+
+	// Replaces the instances of a mesh: count column-major 4x4 matrices, read by the shader as a
+	// mat4 attribute at location..location+3 that advances once per instance
+	void setInstances(MeshHandle handle, const float *matrices, GLsizei count, GLuint location)
+	{
+		Mesh &mesh = meshes[handle - 1];
+		GLsizeiptr bytes = (GLsizeiptr)count * 16 * sizeof(float);
+		bool created = mesh.instanceVBO == 0;
+		if (created)
+			glGenBuffers(1, &mesh.instanceVBO);
+		glState().bindBuffer(GL_ARRAY_BUFFER, mesh.instanceVBO);
+		if (bytes > mesh.instanceBytes)
+		{
+			glBufferData(GL_ARRAY_BUFFER, bytes, matrices, GL_DYNAMIC_DRAW);
+			mesh.instanceBytes = bytes;
+		}
+		else
+		{
+			glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, matrices);
+		}
+		if (created)
+		{
+			glState().bindVertexArray(mesh.VAO);
+			for (GLuint column = 0; column < 4; column++)
+			{
+				glVertexAttribPointer(location + column, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(float), (void*)(column * 4 * sizeof(float)));
+				glEnableVertexAttribArray(location + column);
+				glVertexAttribDivisor(location + column, 1);
+			}
+			glState().bindVertexArray(0);
+		}
+		glState().bindBuffer(GL_ARRAY_BUFFER, 0);
+		mesh.instanceCount = count;
+	}
+
+	const Mesh &get(MeshHandle handle) const
+	{
+		return meshes[handle - 1];
+	}
+
+	// Deletes the GPU objects of a mesh; the handle may be reused by a later create
+	void release(MeshHandle handle)
+	{
+		Mesh &mesh = meshes[handle - 1];
+		glDeleteVertexArrays(1, &mesh.VAO);
+		glDeleteBuffers(1, &mesh.VBO);
+		if (mesh.EBO != 0)
+			glDeleteBuffers(1, &mesh.EBO);
+		if (mesh.instanceVBO != 0)
+			glDeleteBuffers(1, &mesh.instanceVBO);
+		mesh = Mesh();
+		freeHandles.push_back(handle);
+		// deleted objects are unbound by GL behind the cache's back
+		glState().invalidate();
+	}
+
+	// Buffer memory held by one mesh, 0 for the invalid handle
+	GLsizeiptr gpuBytes(MeshHandle handle) const
+	{
+		return handle != 0 ? meshes[handle - 1].vertexBytes + meshes[handle - 1].indexBytes + meshes[handle - 1].instanceBytes : 0;
+	}
+
+	// Buffer memory held by all live meshes
+	GLsizeiptr gpuBytes() const
+	{
+		GLsizeiptr bytes = 0;
+		for (size_t i = 0; i < meshes.size(); i++)
+			bytes += meshes[i].vertexBytes + meshes[i].indexBytes + meshes[i].instanceBytes;
+		return bytes;
+	}
+
+private:
+	std::vector<Mesh> meshes;
+	std::vector<MeshHandle> freeHandles;
+
+	MeshHandle store(const Mesh &mesh)
+	{
+		if (!freeHandles.empty())
+		{
+			MeshHandle handle = freeHandles.back();
+			freeHandles.pop_back();
+			meshes[handle - 1] = mesh;
+			return handle;
+		}
+		meshes.push_back(mesh);
+		return (MeshHandle)meshes.size();
+	}
+};
+
+// The registry shared by all homework modules
+inline MeshRegistry &meshRegistry()
+{
+	static MeshRegistry registry;
+	return registry;
+}
+
+#endif
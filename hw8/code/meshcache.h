@@ -0,0 +1,321 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include "mappedfile.h"
+#include "objloader.h"
+#include "meshoptimize.h"
+#include "mesh.h"
+
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+// Indices of one level of detail, in the mapping or in memory
+struct MeshLod
+{
+	const unsigned int *indices;
+	size_t bytes;
+};
+
+// A mesh ready for upload, either mapped from the cache or converted in memory; the pointers
+// lead into file or into mesh. Level 0 is the full mesh, further levels are coarser.
+struct MeshData
+{
+	MappedFile file;
+	ObjMesh mesh;
+	const float *vertices;
+	size_t vertexBytes;
+	std::vector<MeshLod> lods;
+	glm::vec3 min, max;
+	// vertex cache miss ratio of level 0 as imported and after optimization
+	float acmrBefore, acmrAfter;
+	// whether it came from the cache, and how long getting it ready took
+	bool cached;
+	double milliseconds;
+
+	MeshData() : vertices(NULL), vertexBytes(0), min(0.0f), max(0.0f), acmrBefore(0.0f), acmrAfter(0.0f), cached(false), milliseconds(0.0) {}
+
+	int vertexCount() const
+	{
+		return (int)(vertexBytes / (ObjMesh::STRIDE * sizeof(float)));
+	}
+
+	int triangleCount(int lod = 0) const
+	{
+		return (int)(lods[lod].bytes / (3 * sizeof(unsigned int)));
+	}
+
+	// Uploads the vertices and one level's indices; from a mapping, GL reads the file's pages
+	// directly, with no copy in between
+	MeshHandle create(int lod = 0) const
+	{
+		return meshRegistry().create(vertices, (GLsizeiptr)vertexBytes, lods[lod].indices, (GLsizeiptr)lods[lod].bytes,
+			ObjMesh::STRIDE, { { 0, 3, 0 }, { 1, 3, 3 }, { 2, 2, 6 } });
+	}
+};
+
+// Imported models on disk, so that a run after the first maps them instead of parsing OBJ text.
+// Files are meshcache/<key>.mesh: a header with the bounds, the level table, then the vertex
+// stream and the index stream of every level, each starting at a 16 byte boundary. Like the
+// texture cache, the key hashes the model path and the header keeps the size and time of the
+// source, so an edited model is imported again; a file of another version is never trusted.
+// Imported meshes are reordered for the vertex cache, overdraw and vertex fetch before they are
+// stored, so the cost of that is paid once.
+class MeshCache
+{
+public:
+	MeshCache() : hits(0), conversions(0), microseconds(0) {}
+
+	// Maps the imported model, or parses and stores it. False if it cannot be read at all.
+	bool load(const std::string &path, MeshData &data)
+	{
+		double start = glfwGetTime();
+		struct stat source;
+		if (stat(path.c_str(), &source) != 0)
+			return false;
+		std::string cachePath = fileName(path);
+		data.cached = map(cachePath, source, data);
+		if (!data.cached)
+		{
+			ObjLoader loader;
+			if (!loader.load(path, data.mesh) || data.mesh.indices.empty())
+				return false;
+			optimize(data);
+			data.vertices = data.mesh.vertices.data();
+			data.vertexBytes = data.mesh.vertices.size() * sizeof(float);
+			MeshLod lod = { data.mesh.indices.data(), data.mesh.indices.size() * sizeof(unsigned int) };
+			data.lods.assign(1, lod);
+			data.min = data.mesh.min;
+			data.max = data.mesh.max;
+			write(cachePath, source, data);
+			conversions++;
+		}
+		else
+		{
+			hits++;
+		}
+		data.milliseconds = (glfwGetTime() - start) * 1000.0;
+		microseconds += (long long)(data.milliseconds * 1000.0);
+		return true;
+	}
+
+	int cachedMeshes() const
+	{
+		return hits;
+	}
+
+	int convertedMeshes() const
+	{
+		return conversions;
+	}
+
+	double milliseconds() const
+	{
+		return microseconds / 1000.0;
+	}
+
+private:
+	struct Header
+	{
+		char magic[4];
+		unsigned int version;
+		// floats per vertex
+		unsigned int stride;
+		unsigned int lodCount;
+		long long sourceSize, sourceTime;
+		float min[3], max[3];
+		float acmrBefore, acmrAfter;
+		unsigned long long vertexOffset, vertexBytes;
+	};
+
+	struct LodEntry
+	{
+		unsigned long long offset, bytes;
+	};
+
+	static const unsigned int VERSION = 2;
+	static const unsigned int ALIGNMENT = 16;
+	static const unsigned int MAX_LODS = 8;
+
+	int hits, conversions;
+	long long microseconds;
+
+	static const char *directory()
+	{
+		return "meshcache";
+	}
+
+	static std::string fileName(const std::string &path)
+	{
+		unsigned long long hash = 14695981039346656037ull;
+		for (size_t i = 0; i < path.size(); i++)
+		{
+			hash ^= (unsigned char)path[i];
+			hash *= 1099511628211ull;
+		}
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.mesh", hash);
+		return std::string(directory()) + "/" + name;
+	}
+
+	static unsigned long long align(unsigned long long offset)
+	{
+		return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	}
+
+	// A stream must start aligned and end inside the file
+	static bool inside(unsigned long long offset, unsigned long long bytes, size_t size)
+	{
+		return offset % ALIGNMENT == 0 && offset <= size && bytes <= size - offset;
+	}
+
+	bool map(const std::string &cachePath, const struct stat &source, MeshData &data)
+	{
+		if (!data.file.open(cachePath))
+			return false;
+		const unsigned char *bytes = data.file.data();
+		size_t size = data.file.size();
+		Header header;
+		if (size < sizeof(Header))
+			return reject(data);
+		memcpy(&header, bytes, sizeof(Header));
+		if (memcmp(header.magic, "MESH", 4) != 0 || header.version != VERSION || header.stride != ObjMesh::STRIDE
+			|| header.sourceSize != (long long)source.st_size || header.sourceTime != (long long)source.st_mtime)
+			return reject(data);
+		size_t tableEnd = sizeof(Header) + header.lodCount * sizeof(LodEntry);
+		if (header.lodCount == 0 || header.lodCount > MAX_LODS || tableEnd > size
+			|| !inside(header.vertexOffset, header.vertexBytes, size) || header.vertexBytes % (header.stride * sizeof(float)) != 0)
+			return reject(data);
+		data.lods.clear();
+		for (unsigned int i = 0; i < header.lodCount; i++)
+		{
+			LodEntry entry;
+			memcpy(&entry, bytes + sizeof(Header) + i * sizeof(LodEntry), sizeof(LodEntry));
+			if (!inside(entry.offset, entry.bytes, size) || entry.bytes == 0 || entry.bytes % (3 * sizeof(unsigned int)) != 0)
+				return reject(data);
+			MeshLod lod = { (const unsigned int *)(bytes + entry.offset), (size_t)entry.bytes };
+			// an index past the vertices would have the draw read outside the vertex buffer
+			size_t vertexCount = (size_t)(header.vertexBytes / (header.stride * sizeof(float)));
+			size_t indexCount = lod.bytes / sizeof(unsigned int);
+			unsigned int largest = 0;
+			for (size_t j = 0; j < indexCount; j++)
+				largest = std::max(largest, lod.indices[j]);
+			if (largest >= vertexCount)
+				return reject(data);
+			data.lods.push_back(lod);
+		}
+		data.vertices = (const float *)(bytes + header.vertexOffset);
+		data.vertexBytes = (size_t)header.vertexBytes;
+		data.min = glm::vec3(header.min[0], header.min[1], header.min[2]);
+		data.max = glm::vec3(header.max[0], header.max[1], header.max[2]);
+		data.acmrBefore = header.acmrBefore;
+		data.acmrAfter = header.acmrAfter;
+		return true;
+	}
+
+	static void optimize(MeshData &data)
+	{
+		std::vector<float> &vertices = data.mesh.vertices;
+		std::vector<unsigned int> &indices = data.mesh.indices;
+		size_t vertexCount = vertices.size() / ObjMesh::STRIDE;
+		data.acmrBefore = acmr(indices.data(), indices.size(), vertexCount);
+		optimizeVertexCache(indices.data(), indices.size(), vertexCount);
+		optimizeOverdraw(indices.data(), indices.size(), vertices.data(), vertexCount, ObjMesh::STRIDE);
+		vertexCount = optimizeVertexFetch(vertices.data(), vertexCount, indices.data(), indices.size(), ObjMesh::STRIDE);
+		vertices.resize(vertexCount * ObjMesh::STRIDE);
+		data.mesh.vertexCount = (int)vertexCount;
+		data.acmrAfter = acmr(indices.data(), indices.size(), vertexCount);
+	}
+
+	static bool reject(MeshData &data)
+	{
+		data.file.close();
+		data.lods.clear();
+		return false;
+	}
+
+	static void pad(std::ofstream &file, unsigned long long &offset)
+	{
+		static const char zeros[ALIGNMENT] = {};
+		unsigned long long aligned = align(offset);
+		file.write(zeros, (std::streamsize)(aligned - offset));
+		offset = aligned;
+	}
+
+	void write(const std::string &cachePath, const struct stat &source, const MeshData &data)
+	{
+#ifdef _WIN32
+		_mkdir(directory());
+#else
+		mkdir(directory(), 0755);
+#endif
+		Header header;
+		memcpy(header.magic, "MESH", 4);
+		header.version = VERSION;
+		header.stride = ObjMesh::STRIDE;
+		header.lodCount = (unsigned int)data.lods.size();
+		header.sourceSize = (long long)source.st_size;
+		header.sourceTime = (long long)source.st_mtime;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			header.min[axis] = data.min[axis];
+			header.max[axis] = data.max[axis];
+		}
+		header.acmrBefore = data.acmrBefore;
+		header.acmrAfter = data.acmrAfter;
+		// the layout is decided before anything is written
+		std::vector<LodEntry> table(data.lods.size());
+		header.vertexOffset = align(sizeof(Header) + table.size() * sizeof(LodEntry));
+		header.vertexBytes = data.vertexBytes;
+		unsigned long long offset = header.vertexOffset + header.vertexBytes;
+		for (size_t i = 0; i < table.size(); i++)
+		{
+			table[i].offset = align(offset);
+			table[i].bytes = data.lods[i].bytes;
+			offset = table[i].offset + table[i].bytes;
+		}
+		// written under a temporary name, so a reader never maps half a file
+		std::string temporary = cachePath + ".part";
+		{
+			std::ofstream file(temporary.c_str(), std::ios::binary);
+			file.write((const char *)&header, sizeof(header));
+			file.write((const char *)table.data(), (std::streamsize)(table.size() * sizeof(LodEntry)));
+			offset = sizeof(Header) + table.size() * sizeof(LodEntry);
+			pad(file, offset);
+			file.write((const char *)data.vertices, (std::streamsize)data.vertexBytes);
+			offset += data.vertexBytes;
+			for (size_t i = 0; i < table.size(); i++)
+			{
+				pad(file, offset);
+				file.write((const char *)data.lods[i].indices, (std::streamsize)data.lods[i].bytes);
+				offset += data.lods[i].bytes;
+			}
+			if (!file)
+			{
+				file.close();
+				std::remove(temporary.c_str());
+				return;
+			}
+		}
+		std::remove(cachePath.c_str());
+		std::rename(temporary.c_str(), cachePath.c_str());
+	}
+};
+
+inline MeshCache &meshCache()
+{
+	static MeshCache cache;
+	return cache;
+}
+
+#endif
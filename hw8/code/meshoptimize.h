@@ -0,0 +1,264 @@
+#ifndef MESHOPTIMIZE_H
+#define MESHOPTIMIZE_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Reordering of indexed triangle lists for the GPU, run on meshes as they are imported:
+//   optimizeVertexCache  triangle order that reuses transformed vertices (Forsyth's method)
+//   optimizeOverdraw     clusters of that order facing outwards go first, so they hide the rest
+//   optimizeVertexFetch  vertices in the order the triangles first use them
+// acmr measures the vertex cache: vertex shader runs per triangle, 0.5 at best, 3 at worst.
+
+// size of the FIFO cache acmr simulates, a typical post-transform cache
+static const int VERTEX_CACHE_SIZE = 16;
+// size of the LRU cache optimizeVertexCache scores against
+static const int FORSYTH_CACHE_SIZE = 32;
+
+// Average cache miss ratio of a triangle list on a FIFO cache of cacheSize vertices
+inline float acmr(const unsigned int *indices, size_t indexCount, size_t vertexCount, int cacheSize = VERTEX_CACHE_SIZE)
+{
+	if (indexCount < 3)
+		return 0.0f;
+	// a vertex is in the cache while fewer than cacheSize misses happened since its own
+	std::vector<unsigned int> missedAt(vertexCount, 0);
+	unsigned int misses = 0;
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		unsigned int v = indices[i];
+		if (missedAt[v] == 0 || misses - missedAt[v] >= (unsigned int)cacheSize)
+			missedAt[v] = ++misses;
+	}
+	return misses / (float)(indexCount / 3);
+}
+
+// Score of a vertex at a place in the LRU cache (-1 outside) with valence triangles left to emit
+inline float forsythScore(int cachePosition, int valence)
+{
+	if (valence == 0)
+		return -1.0f;
+	float score = 0.0f;
+	// the last triangle's vertices score the same, so its orientation does not matter
+	if (cachePosition >= 0)
+		score = cachePosition < 3 ? 0.75f : std::pow(1.0f - (cachePosition - 3) / (float)(FORSYTH_CACHE_SIZE - 3), 1.5f);
+	// vertices with few triangles left are finished first, not to leave lone triangles behind
+	return score + 2.0f / std::sqrt((float)valence);
+}
+
+// Reorders the triangles so the ones whose vertices are in the cache go next. The triangle with
+// the highest sum of its vertex scores is emitted, and only the scores around the cache change.
+// After Tom Forsyth, "Linear-Speed Vertex Cache Optimisation".
+inline void optimizeVertexCache(unsigned int *indices, size_t indexCount, size_t vertexCount)
+{
+	const int CACHE_SIZE = FORSYTH_CACHE_SIZE;
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+		return;
+
+	// triangles of each vertex
+	std::vector<unsigned int> offsets(vertexCount + 1, 0), adjacency(indexCount);
+	std::vector<int> valence(vertexCount, 0);
+	for (size_t i = 0; i < indexCount; i++)
+		valence[indices[i]]++;
+	for (size_t v = 0; v < vertexCount; v++)
+		offsets[v + 1] = offsets[v] + valence[v];
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < indexCount; i++)
+		adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+
+	// the scores of common cases, so the inner loop needs no pow or sqrt
+	const int TABLE_VALENCE = 32;
+	float scores[CACHE_SIZE + 1][TABLE_VALENCE];
+	for (int position = -1; position < CACHE_SIZE; position++)
+	{
+		for (int count = 0; count < TABLE_VALENCE; count++)
+			scores[position + 1][count] = forsythScore(position, count);
+	}
+	auto score = [&scores](int position, int count) {
+		return count < TABLE_VALENCE ? scores[position + 1][count] : forsythScore(position, count);
+	};
+
+	std::vector<float> vertexScore(vertexCount), triangleScore(triangleCount, 0.0f);
+	std::vector<int> cachePosition(vertexCount, -1);
+	for (size_t v = 0; v < vertexCount; v++)
+		vertexScore[v] = score(-1, valence[v]);
+	for (size_t t = 0; t < triangleCount; t++)
+		triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+	std::vector<char> emitted(triangleCount, 0);
+	std::vector<unsigned int> result(indexCount);
+
+	int cache[CACHE_SIZE + 3];
+	int cacheCount = 0;
+	size_t scan = 0;
+	long long best = (long long)(std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin());
+	for (size_t out = 0; out < triangleCount; out++)
+	{
+		// without a candidate near the cache, the next triangle left in input order
+		if (best < 0)
+		{
+			while (emitted[scan])
+				scan++;
+			best = (long long)scan;
+		}
+		unsigned int *triangle = indices + best * 3;
+		memcpy(&result[out * 3], triangle, 3 * sizeof(unsigned int));
+		emitted[best] = 1;
+
+		// the triangle leaves the lists of its vertices
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int v = triangle[k];
+			unsigned int *first = &adjacency[offsets[v]], *last = first + valence[v];
+			*std::find(first, last, (unsigned int)best) = *(last - 1);
+			valence[v]--;
+		}
+
+		// its vertices move to the front of the cache, pushing the rest back
+		int next[CACHE_SIZE + 3];
+		int nextCount = 0;
+		for (int k = 0; k < 3; k++)
+			next[nextCount++] = (int)triangle[k];
+		for (int i = 0; i < cacheCount; i++)
+		{
+			int v = cache[i];
+			if (v != (int)triangle[0] && v != (int)triangle[1] && v != (int)triangle[2])
+				next[nextCount++] = v;
+		}
+		memcpy(cache, next, nextCount * sizeof(int));
+		cacheCount = nextCount;
+
+		// rescore the cached vertices and their triangles; the ones pushed out lose their cache score
+		best = -1;
+		float bestScore = -1.0f;
+		for (int i = 0; i < cacheCount; i++)
+		{
+			int v = cache[i];
+			cachePosition[v] = i < CACHE_SIZE ? i : -1;
+			float updated = score(cachePosition[v], valence[v]);
+			float change = updated - vertexScore[v];
+			vertexScore[v] = updated;
+			for (int j = 0; j < valence[v]; j++)
+			{
+				unsigned int t = adjacency[offsets[v] + j];
+				triangleScore[t] += change;
+				if (triangleScore[t] > bestScore)
+				{
+					bestScore = triangleScore[t];
+					best = t;
+				}
+			}
+		}
+		cacheCount = std::min(cacheCount, CACHE_SIZE);
+	}
+	memcpy(indices, result.data(), indexCount * sizeof(unsigned int));
+}
+
+// Reorders clusters of the triangle order so those facing away from the mesh's center are drawn
+// first; from most views they cover the others, which then fail the depth test before shading.
+// Clusters end where the FIFO cache starts over or misses anyway, so their order barely changes
+// the cache behaviour; if acmr still grows by more than threshold, the order is left alone.
+inline void optimizeOverdraw(unsigned int *indices, size_t indexCount, const float *vertices, size_t vertexCount, int stride, float threshold = 1.05f)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount < 2)
+		return;
+	// clusters start where all three vertices miss the cache, or, once a cluster is long, where
+	// any one misses
+	const size_t CLUSTER_SIZE = 128;
+	std::vector<size_t> starts;
+	std::vector<unsigned int> missedAt(vertexCount, 0);
+	unsigned int misses = 0;
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		int triangleMisses = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int v = indices[t * 3 + k];
+			if (missedAt[v] == 0 || misses - missedAt[v] >= (unsigned int)VERTEX_CACHE_SIZE)
+			{
+				missedAt[v] = ++misses;
+				triangleMisses++;
+			}
+		}
+		if (t == 0 || triangleMisses == 3 || (triangleMisses > 0 && t - starts.back() >= CLUSTER_SIZE))
+			starts.push_back(t);
+	}
+	starts.push_back(triangleCount);
+	if (starts.size() < 3)
+		return;
+
+	glm::vec3 center(0.0f);
+	for (size_t v = 0; v < vertexCount; v++)
+		center += glm::vec3(vertices[v * stride], vertices[v * stride + 1], vertices[v * stride + 2]);
+	center = center / (float)vertexCount;
+
+	struct Cluster
+	{
+		size_t first, count;
+		float facing;
+	};
+	std::vector<Cluster> clusters(starts.size() - 1);
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		Cluster &cluster = clusters[c];
+		cluster.first = starts[c];
+		cluster.count = starts[c + 1] - starts[c];
+		// area weighted centroid and normal
+		glm::vec3 centroid(0.0f), normal(0.0f);
+		float area = 0.0f;
+		for (size_t t = cluster.first; t < cluster.first + cluster.count; t++)
+		{
+			glm::vec3 p[3];
+			for (int k = 0; k < 3; k++)
+			{
+				const float *v = vertices + indices[t * 3 + k] * stride;
+				p[k] = glm::vec3(v[0], v[1], v[2]);
+			}
+			glm::vec3 n = glm::cross(p[1] - p[0], p[2] - p[0]);
+			float a = glm::length(n);
+			centroid += (p[0] + p[1] + p[2]) * (a / 3.0f);
+			normal += n;
+			area += a;
+		}
+		float length = glm::length(normal);
+		cluster.facing = area > 0.0f && length > 0.0f ? glm::dot(centroid / area - center, normal / length) : 0.0f;
+	}
+	std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster &a, const Cluster &b) { return a.facing > b.facing; });
+
+	std::vector<unsigned int> result;
+	result.reserve(indexCount);
+	for (size_t c = 0; c < clusters.size(); c++)
+		result.insert(result.end(), indices + clusters[c].first * 3, indices + (clusters[c].first + clusters[c].count) * 3);
+	if (acmr(result.data(), indexCount, vertexCount) <= acmr(indices, indexCount, vertexCount) * threshold)
+		memcpy(indices, result.data(), indexCount * sizeof(unsigned int));
+}
+
+// Moves the vertices into the order the triangles first use them, so vertex fetches walk the
+// buffer forwards; unused vertices are dropped. Returns the new vertex count.
+inline size_t optimizeVertexFetch(float *vertices, size_t vertexCount, unsigned int *indices, size_t indexCount, int stride)
+{
+	const unsigned int UNUSED = 0xFFFFFFFF;
+	std::vector<unsigned int> remap(vertexCount, UNUSED);
+	std::vector<float> result;
+	result.reserve(vertexCount * stride);
+	unsigned int used = 0;
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		unsigned int &target = remap[indices[i]];
+		if (target == UNUSED)
+		{
+			target = used++;
+			const float *v = vertices + (size_t)indices[i] * stride;
+			result.insert(result.end(), v, v + stride);
+		}
+		indices[i] = target;
+	}
+	memcpy(vertices, result.data(), result.size() * sizeof(float));
+	return used;
+}
+
+#endif
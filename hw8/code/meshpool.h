@@ -0,0 +1,199 @@
+#ifndef MESHPOOL_H
+#define MESHPOOL_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "glstate.h"
+#include "glextensions.h"
+#include "mesh.h"
+
+#include <vector>
+#include <algorithm>
+#include <initializer_list>
+
+// Static meshes of one vertex layout packed into a single VAO: one vertex buffer, one index
+// buffer and one buffer of per-instance model matrices. A frame's draws are collected as
+// indirect commands and sent with one glMultiDrawElementsIndirect; without it every command is
+// drawn on its own, with the instance attributes pointed at its first matrix.
+class MeshPool
+{
+public:
+	MeshPool(GLsizei stride, std::initializer_list<VertexAttribute> attributes, GLuint instanceLocation)
+		: stride(stride), attributes(attributes), instanceLocation(instanceLocation),
+		VAO(0), VBO(0), EBO(0), instanceVBO(0), indirectBuffer(0), instanceBytes(0), indirectBytes(0), geometryBytes(0), lastCalls(0)
+	{
+	}
+
+	// Adds a mesh to be uploaded with the next upload(); without indices its vertices are drawn
+	// in order. Returns the mesh's id in the pool.
+	int add(const float *vertices, GLsizeiptr vertexBytes, const unsigned int *indices, GLsizeiptr indexBytes)
+	{
+		Range range;
+		range.baseVertex = (GLint)(vertexData.size() / stride);
+		range.firstIndex = (GLuint)indexData.size();
+		GLuint vertexCount = (GLuint)(vertexBytes / (stride * sizeof(float)));
+		vertexData.insert(vertexData.end(), vertices, vertices + vertexBytes / sizeof(float));
+		if (indices != NULL)
+		{
+			indexData.insert(indexData.end(), indices, indices + indexBytes / sizeof(unsigned int));
+		}
+		else
+		{
+			for (GLuint i = 0; i < vertexCount; i++)
+				indexData.push_back(i);
+		}
+		range.indexCount = (GLuint)indexData.size() - range.firstIndex;
+		ranges.push_back(range);
+		return (int)ranges.size() - 1;
+	}
+
+	// Creates the buffers from the added meshes; the CPU copies are dropped
+	void upload()
+	{
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &VBO);
+		glGenBuffers(1, &EBO);
+		glGenBuffers(1, &instanceVBO);
+		glState().bindVertexArray(VAO);
+		glState().bindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, vertexData.size() * sizeof(float), vertexData.data(), GL_STATIC_DRAW);
+		glState().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexData.size() * sizeof(unsigned int), indexData.data(), GL_STATIC_DRAW);
+		for (size_t i = 0; i < attributes.size(); i++)
+		{
+			const VertexAttribute &attribute = attributes[i];
+			glVertexAttribPointer(attribute.index, attribute.size, GL_FLOAT, GL_FALSE, stride * sizeof(float), (void*)(attribute.offset * sizeof(float)));
+			glEnableVertexAttribArray(attribute.index);
+		}
+		glState().bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+		pointInstances(0);
+		for (GLuint column = 0; column < 4; column++)
+		{
+			glEnableVertexAttribArray(instanceLocation + column);
+			glVertexAttribDivisor(instanceLocation + column, 1);
+		}
+		glState().bindVertexArray(0);
+		glState().bindBuffer(GL_ARRAY_BUFFER, 0);
+		geometryBytes = (GLsizeiptr)(vertexData.size() * sizeof(float) + indexData.size() * sizeof(unsigned int));
+		std::vector<float>().swap(vertexData);
+		std::vector<unsigned int>().swap(indexData);
+	}
+
+	bool uploaded() const
+	{
+		return VAO != 0;
+	}
+
+	void release()
+	{
+		if (VAO == 0)
+			return;
+		glDeleteVertexArrays(1, &VAO);
+		GLuint buffers[4] = { VBO, EBO, instanceVBO, indirectBuffer };
+		glDeleteBuffers(indirectBuffer != 0 ? 4 : 3, buffers);
+		VAO = VBO = EBO = instanceVBO = indirectBuffer = 0;
+		instanceBytes = indirectBytes = geometryBytes = 0;
+		ranges.clear();
+		glState().invalidate();
+	}
+
+	// Queues count instances of a mesh for the next submit
+	void draw(int mesh, const glm::mat4 *models, GLsizei count)
+	{
+		if (count == 0)
+			return;
+		const Range &range = ranges[mesh];
+		IndirectCommand command = { range.indexCount, (GLuint)count, range.firstIndex, range.baseVertex, (GLuint)instances.size() };
+		commands.push_back(command);
+		instances.insert(instances.end(), models, models + count);
+	}
+
+	// Draws everything queued since the last submit with the program and textures that are bound
+	void submit(GLenum mode = GL_TRIANGLES)
+	{
+		lastCalls = 0;
+		if (commands.empty())
+			return;
+		glState().bindVertexArray(VAO);
+		// orphaned every submit, so the passes of a frame do not wait for each other
+		glState().bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+		GLsizeiptr bytes = (GLsizeiptr)(instances.size() * sizeof(glm::mat4));
+		glBufferData(GL_ARRAY_BUFFER, bytes, instances.data(), GL_STREAM_DRAW);
+		instanceBytes = std::max(instanceBytes, bytes);
+		if (glExtensions().multiDrawIndirect)
+		{
+			if (indirectBuffer == 0)
+				glGenBuffers(1, &indirectBuffer);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+			bytes = (GLsizeiptr)(commands.size() * sizeof(IndirectCommand));
+			glBufferData(GL_DRAW_INDIRECT_BUFFER, bytes, commands.data(), GL_STREAM_DRAW);
+			indirectBytes = std::max(indirectBytes, bytes);
+			glExtensions().multiDrawElementsIndirect(mode, GL_UNSIGNED_INT, 0, (GLsizei)commands.size(), 0);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+			lastCalls = 1;
+		}
+		else
+		{
+			for (size_t i = 0; i < commands.size(); i++)
+			{
+				const IndirectCommand &command = commands[i];
+				pointInstances(command.baseInstance);
+				glDrawElementsInstancedBaseVertex(mode, command.count, GL_UNSIGNED_INT, (void*)(command.firstIndex * sizeof(unsigned int)),
+					command.instanceCount, command.baseVertex);
+			}
+			pointInstances(0);
+			lastCalls = (int)commands.size();
+		}
+		commands.clear();
+		instances.clear();
+	}
+
+	// Draw calls made by the last submit
+	int drawCalls() const
+	{
+		return lastCalls;
+	}
+
+	GLsizeiptr gpuBytes() const
+	{
+		return geometryBytes + instanceBytes + indirectBytes;
+	}
+
+private:
+	// The layout glMultiDrawElementsIndirect reads
+	struct IndirectCommand
+	{
+		GLuint count, instanceCount, firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+
+	struct Range
+	{
+		GLuint firstIndex, indexCount;
+		GLint baseVertex;
+	};
+
+	GLsizei stride;
+	std::vector<VertexAttribute> attributes;
+	GLuint instanceLocation;
+	GLuint VAO, VBO, EBO, instanceVBO, indirectBuffer;
+	GLsizeiptr instanceBytes, indirectBytes, geometryBytes;
+	int lastCalls;
+	std::vector<Range> ranges;
+	std::vector<float> vertexData;
+	std::vector<unsigned int> indexData;
+	std::vector<IndirectCommand> commands;
+	std::vector<glm::mat4> instances;
+
+	// Points the matrix attributes at an instance of the bound instance buffer
+	void pointInstances(GLuint first)
+	{
+		for (GLuint column = 0; column < 4; column++)
+			glVertexAttribPointer(instanceLocation + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+				(void*)(first * sizeof(glm::mat4) + column * 4 * sizeof(float)));
+	}
+};
+
+#endif
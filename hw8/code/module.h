@@ -0,0 +1,226 @@
+#ifndef MODULE_H
+#define MODULE_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+// One homework module and its lifecycle hooks. init does a step of loading and returns true once
+// the module can be shown; update and render run every frame it is shown; shutdown frees every
+// GPU resource it holds, after which init starts over. update may be NULL.
+struct Module
+{
+	const char *label, *hint;
+	bool (*init)();
+	void (*update)(GLFWwindow *);
+	void (*render)();
+	void (*shutdown)();
+	// GPU memory held by the module right now, whether it is ready or still loading
+	GLsizeiptr (*gpuBytes)();
+};
+
+// The modules of the program in menu order. It loads the requested module with priority and
+// the others in the background, shows a module once it is ready, and releases the least
+// recently shown modules while their GPU memory exceeds the budget.
+class ModuleRegistry
+{
+public:
+	ModuleRegistry() : requested(-1), shownModule(-1), next(0), frame(0), releases(0), budgetBytes(16 << 20) {}
+
+	// Returns the id the module is requested and shown with
+	int add(const Module &module)
+	{
+		modules.push_back(module);
+		states.push_back(State());
+		return (int)modules.size() - 1;
+	}
+
+	int count() const
+	{
+		return (int)modules.size();
+	}
+
+	const Module &get(int id) const
+	{
+		return modules[id];
+	}
+
+	// Shows the module as soon as it is ready
+	void request(int id)
+	{
+		requested = id;
+	}
+
+	// The module being shown, -1 before any is
+	int shown() const
+	{
+		return shownModule;
+	}
+
+	// The module waiting to replace the shown one, -1 if there is none
+	int loading() const
+	{
+		return requested != shownModule ? requested : -1;
+	}
+
+	// One step of loading per frame: the requested module first, otherwise the next module that
+	// has never been loaded, as long as memory is under budget. Released modules are only
+	// loaded again when they are requested, so they cannot thrash against the budget.
+	void prepare()
+	{
+		if (requested >= 0 && !states[requested].ready)
+		{
+			step(requested);
+		}
+		else if (residentBytes() < budgetBytes)
+		{
+			for (int i = 0; i < count(); i++)
+			{
+				int id = (next + i) % count();
+				if (!states[id].ready && !states[id].released)
+				{
+					step(id);
+					next = (id + 1) % count();
+					break;
+				}
+			}
+		}
+		if (requested >= 0 && requested != shownModule && states[requested].ready)
+			shownModule = requested;
+	}
+
+	// Updates and draws the shown module, then brings memory back under budget
+	void render(GLFWwindow *window)
+	{
+		frame++;
+		if (shownModule < 0)
+			return;
+		State &state = states[shownModule];
+		state.lastShown = frame;
+		if (modules[shownModule].update != NULL)
+			modules[shownModule].update(window);
+		modules[shownModule].render();
+		trim();
+	}
+
+	// Releases the modules that are neither shown nor requested, least recently shown first,
+	// until their memory fits in the budget
+	void trim()
+	{
+		while (residentBytes() > budgetBytes)
+		{
+			int victim = -1;
+			for (int i = 0; i < count(); i++)
+			{
+				if (i == shownModule || i == requested || modules[i].gpuBytes() == 0)
+					continue;
+				if (victim < 0 || states[i].lastShown < states[victim].lastShown)
+					victim = i;
+			}
+			if (victim < 0)
+				break;
+			release(victim);
+		}
+	}
+
+	// Frees everything at exit, while the context is still current
+	void shutdown()
+	{
+		for (int i = 0; i < count(); i++)
+			modules[i].shutdown();
+		requested = shownModule = -1;
+	}
+
+	bool ready(int id) const
+	{
+		return states[id].ready;
+	}
+
+	// Whether prepare has nothing left to load: every module is ready, released, or held back
+	// by the budget
+	bool settled() const
+	{
+		if (requested >= 0 && !states[requested].ready)
+			return false;
+		if (residentBytes() >= budgetBytes)
+			return true;
+		for (int i = 0; i < count(); i++)
+		{
+			if (!states[i].ready && !states[i].released)
+				return false;
+		}
+		return true;
+	}
+
+	GLsizeiptr residentBytes() const
+	{
+		GLsizeiptr bytes = 0;
+		for (int i = 0; i < count(); i++)
+			bytes += modules[i].gpuBytes();
+		return bytes;
+	}
+
+	int residentModules() const
+	{
+		int resident = 0;
+		for (int i = 0; i < count(); i++)
+		{
+			if (states[i].ready || modules[i].gpuBytes() > 0)
+				resident++;
+		}
+		return resident;
+	}
+
+	// Times a module was released to stay under budget
+	int releasedModules() const
+	{
+		return releases;
+	}
+
+	GLsizeiptr budget() const
+	{
+		return budgetBytes;
+	}
+
+	void setBudget(GLsizeiptr bytes)
+	{
+		budgetBytes = bytes;
+	}
+
+private:
+	struct State
+	{
+		bool ready, released;
+		unsigned int lastShown;
+		State() : ready(false), released(false), lastShown(0) {}
+	};
+
+	std::vector<Module> modules;
+	std::vector<State> states;
+	int requested, shownModule, next;
+	unsigned int frame;
+	int releases;
+	GLsizeiptr budgetBytes;
+
+	void step(int id)
+	{
+		states[id].ready = modules[id].init();
+	}
+
+	void release(int id)
+	{
+		modules[id].shutdown();
+		states[id].ready = false;
+		states[id].released = true;
+		releases++;
+	}
+};
+
+inline ModuleRegistry &moduleRegistry()
+{
+	static ModuleRegistry registry;
+	return registry;
+}
+
+#endif
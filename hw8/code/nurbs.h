@@ -0,0 +1,262 @@
+#ifndef NURBS_H
+#define NURBS_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CURVE_USE_SSE 1
+#include <xmmintrin.h>
+#endif
+
+// Rational Bezier curve: every control point carries a weight, so conics and circular arcs are exact.
+// Evaluation runs the Bernstein Horner scheme on homogeneous points (w * P, w) and divides at the end.
+// The batch call writes struct-of-arrays output and evaluates four parameters per SSE instruction.
+class RationalBezier
+{
+public:
+	std::vector<glm::vec2> points;
+	std::vector<float> weights;
+
+	glm::vec2 evaluate(float t) const
+	{
+		int count = (int)points.size();
+		if (count == 0)
+			return glm::vec2(0.0f);
+		if (count == 1)
+			return points[0];
+		int n = count - 1;
+		float s = 1.0f - t;
+		float power = 1.0f, binom = 1.0f;
+		float x = points[0].x * weights[0] * s;
+		float y = points[0].y * weights[0] * s;
+		float w = weights[0] * s;
+		for (int i = 1; i < n; i++)
+		{
+			power *= t;
+			binom = binom * (float)(n - i + 1) / (float)i;
+			float b = power * binom;
+			x = (x + points[i].x * weights[i] * b) * s;
+			y = (y + points[i].y * weights[i] * b) * s;
+			w = (w + weights[i] * b) * s;
+		}
+		power *= t;
+		x += points[n].x * weights[n] * power;
+		y += points[n].y * weights[n] * power;
+		w += weights[n] * power;
+		return glm::vec2(x, y) / w;
+	}
+
+	// Evaluates count parameters t[i] into outX[i], outY[i]
+	void evaluate(const float *t, int count, float *outX, float *outY) const
+	{
+		int i = 0;
+#ifdef CURVE_USE_SSE
+		int size = (int)points.size();
+		if (size >= 2)
+		{
+			int n = size - 1;
+			// homogeneous control points, scaled by the binomial coefficients once per batch
+			std::vector<float> hx(size), hy(size), hw(size);
+			float binom = 1.0f;
+			for (int j = 0; j <= n; j++)
+			{
+				hw[j] = weights[j] * binom;
+				hx[j] = points[j].x * hw[j];
+				hy[j] = points[j].y * hw[j];
+				binom = binom * (float)(n - j) / (float)(j + 1);
+			}
+			const __m128 one = _mm_set1_ps(1.0f);
+			for (; i + 4 <= count; i += 4)
+			{
+				__m128 tt = _mm_loadu_ps(t + i);
+				__m128 s = _mm_sub_ps(one, tt);
+				__m128 power = one;
+				__m128 x = _mm_mul_ps(_mm_set1_ps(hx[0]), s);
+				__m128 y = _mm_mul_ps(_mm_set1_ps(hy[0]), s);
+				__m128 w = _mm_mul_ps(_mm_set1_ps(hw[0]), s);
+				for (int j = 1; j < n; j++)
+				{
+					power = _mm_mul_ps(power, tt);
+					x = _mm_mul_ps(_mm_add_ps(x, _mm_mul_ps(_mm_set1_ps(hx[j]), power)), s);
+					y = _mm_mul_ps(_mm_add_ps(y, _mm_mul_ps(_mm_set1_ps(hy[j]), power)), s);
+					w = _mm_mul_ps(_mm_add_ps(w, _mm_mul_ps(_mm_set1_ps(hw[j]), power)), s);
+				}
+				power = _mm_mul_ps(power, tt);
+				x = _mm_add_ps(x, _mm_mul_ps(_mm_set1_ps(hx[n]), power));
+				y = _mm_add_ps(y, _mm_mul_ps(_mm_set1_ps(hy[n]), power));
+				w = _mm_add_ps(w, _mm_mul_ps(_mm_set1_ps(hw[n]), power));
+				_mm_storeu_ps(outX + i, _mm_div_ps(x, w));
+				_mm_storeu_ps(outY + i, _mm_div_ps(y, w));
+			}
+		}
+#endif
+		for (; i < count; i++)
+		{
+			glm::vec2 p = evaluate(t[i]);
+			outX[i] = p.x;
+			outY[i] = p.y;
+		}
+	}
+};
+
+// Non-uniform rational B-spline curve of degree up to MAX_DEGREE with an explicit knot vector
+// (points.size() + degree + 1 knots). Parameters passed to evaluate are normalized to [0, 1] and
+// mapped onto the valid knot range. The batch call runs de Boor's algorithm on four parameters
+// at once whenever they fall into the same knot span, which is the common case for sorted input.
+class NurbsCurve
+{
+public:
+	static const int MAX_DEGREE = 7;
+
+	int degree;
+	std::vector<glm::vec2> points;
+	std::vector<float> weights;
+	std::vector<float> knots;
+
+	NurbsCurve() : degree(3) {}
+
+	// Clamped knot vector with uniformly spaced interior knots, so the curve touches its end points
+	static std::vector<float> clampedKnots(int count, int degree)
+	{
+		std::vector<float> knots;
+		int interior = count - degree - 1;
+		for (int i = 0; i <= degree; i++)
+			knots.push_back(0.0f);
+		for (int i = 1; i <= interior; i++)
+			knots.push_back((float)i / (float)(interior + 1));
+		for (int i = 0; i <= degree; i++)
+			knots.push_back(1.0f);
+		return knots;
+	}
+
+	// Exact circle made of four quadratic rational arcs
+	static NurbsCurve circle(glm::vec2 center, float radius)
+	{
+		static const float px[9] = { 1, 1, 0, -1, -1, -1, 0, 1, 1 };
+		static const float py[9] = { 0, 1, 1, 1, 0, -1, -1, -1, 0 };
+		static const float knots[12] = { 0, 0, 0, 0.25f, 0.25f, 0.5f, 0.5f, 0.75f, 0.75f, 1, 1, 1 };
+		NurbsCurve curve;
+		curve.degree = 2;
+		for (int i = 0; i < 9; i++)
+		{
+			curve.points.push_back(center + radius * glm::vec2(px[i], py[i]));
+			curve.weights.push_back(i % 2 ? std::sqrt(0.5f) : 1.0f);
+		}
+		curve.knots.assign(knots, knots + 12);
+		return curve;
+	}
+
+	bool valid() const
+	{
+		return degree >= 1 && degree <= MAX_DEGREE && (int)points.size() > degree
+			&& weights.size() == points.size() && knots.size() == points.size() + degree + 1;
+	}
+
+	glm::vec2 evaluate(float t) const
+	{
+		if (!valid())
+			return points.empty() ? glm::vec2(0.0f) : points[0];
+		float u = toKnot(t);
+		int k = findSpan(u);
+		float dx[MAX_DEGREE + 1], dy[MAX_DEGREE + 1], dw[MAX_DEGREE + 1];
+		for (int j = 0; j <= degree; j++)
+		{
+			int i = k - degree + j;
+			dw[j] = weights[i];
+			dx[j] = points[i].x * weights[i];
+			dy[j] = points[i].y * weights[i];
+		}
+		for (int r = 1; r <= degree; r++)
+		{
+			for (int j = degree; j >= r; j--)
+			{
+				int i = j + k - degree;
+				float alpha = (u - knots[i]) / (knots[i + degree - r + 1] - knots[i]);
+				dx[j] = dx[j - 1] + alpha * (dx[j] - dx[j - 1]);
+				dy[j] = dy[j - 1] + alpha * (dy[j] - dy[j - 1]);
+				dw[j] = dw[j - 1] + alpha * (dw[j] - dw[j - 1]);
+			}
+		}
+		return glm::vec2(dx[degree], dy[degree]) / dw[degree];
+	}
+
+	// Evaluates count parameters t[i] into outX[i], outY[i]
+	void evaluate(const float *t, int count, float *outX, float *outY) const
+	{
+		int i = 0;
+#ifdef CURVE_USE_SSE
+		if (valid())
+		{
+			for (; i + 4 <= count; i += 4)
+			{
+				float u[4];
+				for (int l = 0; l < 4; l++)
+					u[l] = toKnot(t[i + l]);
+				int k = findSpan(u[0]);
+				if (findSpan(u[3]) != k || findSpan(u[1]) != k || findSpan(u[2]) != k)
+				{
+					for (int l = 0; l < 4; l++)
+					{
+						glm::vec2 p = evaluate(t[i + l]);
+						outX[i + l] = p.x;
+						outY[i + l] = p.y;
+					}
+					continue;
+				}
+				__m128 uu = _mm_loadu_ps(u);
+				__m128 dx[MAX_DEGREE + 1], dy[MAX_DEGREE + 1], dw[MAX_DEGREE + 1];
+				for (int j = 0; j <= degree; j++)
+				{
+					int c = k - degree + j;
+					dw[j] = _mm_set1_ps(weights[c]);
+					dx[j] = _mm_set1_ps(points[c].x * weights[c]);
+					dy[j] = _mm_set1_ps(points[c].y * weights[c]);
+				}
+				for (int r = 1; r <= degree; r++)
+				{
+					for (int j = degree; j >= r; j--)
+					{
+						int c = j + k - degree;
+						__m128 alpha = _mm_mul_ps(_mm_sub_ps(uu, _mm_set1_ps(knots[c])),
+							_mm_set1_ps(1.0f / (knots[c + degree - r + 1] - knots[c])));
+						dx[j] = _mm_add_ps(dx[j - 1], _mm_mul_ps(alpha, _mm_sub_ps(dx[j], dx[j - 1])));
+						dy[j] = _mm_add_ps(dy[j - 1], _mm_mul_ps(alpha, _mm_sub_ps(dy[j], dy[j - 1])));
+						dw[j] = _mm_add_ps(dw[j - 1], _mm_mul_ps(alpha, _mm_sub_ps(dw[j], dw[j - 1])));
+					}
+				}
+				_mm_storeu_ps(outX + i, _mm_div_ps(dx[degree], dw[degree]));
+				_mm_storeu_ps(outY + i, _mm_div_ps(dy[degree], dw[degree]));
+			}
+		}
+#endif
+		for (; i < count; i++)
+		{
+			glm::vec2 p = evaluate(t[i]);
+			outX[i] = p.x;
+			outY[i] = p.y;
+		}
+	}
+
+private:
+	float toKnot(float t) const
+	{
+		float first = knots[degree], last = knots[points.size()];
+		return first + std::min(std::max(t, 0.0f), 1.0f) * (last - first);
+	}
+
+	// Index k of the knot span with knots[k] <= u < knots[k + 1]; the end of the range maps to the last span
+	int findSpan(float u) const
+	{
+		int n = (int)points.size() - 1;
+		if (u >= knots[n + 1])
+			return n;
+		int k = (int)(std::upper_bound(knots.begin() + degree, knots.begin() + n + 1, u) - knots.begin()) - 1;
+		return std::max(k, degree);
+	}
+};
+
+#endif
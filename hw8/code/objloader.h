@@ -0,0 +1,389 @@
+#ifndef OBJLOADER_H
+#define OBJLOADER_H
+
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include "mappedfile.h"
+#include "mesh.h"
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+// Indexed triangles read from an OBJ file. Vertices are interleaved like the arrays of hw4-hw7:
+// position, normal, texture coords
+struct ObjMesh
+{
+	static const int STRIDE = 8;
+
+	std::vector<float> vertices;
+	std::vector<unsigned int> indices;
+	glm::vec3 min, max;
+	// what the last load read, and how long it took
+	int vertexCount, triangleCount;
+	size_t fileBytes;
+	double milliseconds;
+
+	ObjMesh() : min(0.0f), max(0.0f), vertexCount(0), triangleCount(0), fileBytes(0), milliseconds(0.0) {}
+
+	double megabytesPerSecond() const
+	{
+		return milliseconds > 0.0 ? fileBytes / (milliseconds * 1000.0) : 0.0;
+	}
+
+	// Uploads the mesh with the attribute locations of the hw7 shaders
+	MeshHandle create() const
+	{
+		return meshRegistry().create(vertices.data(), (GLsizeiptr)(vertices.size() * sizeof(float)), indices.data(),
+			(GLsizeiptr)(indices.size() * sizeof(unsigned int)), STRIDE, { { 0, 3, 0 }, { 1, 3, 3 }, { 2, 2, 6 } });
+	}
+};
+
+// Reads the v, vt, vn and f lines of a Wavefront OBJ file; polygons are split into fans and every
+// other line (groups, materials, smoothing) is skipped. The file is mapped and parsed in place,
+// numbers included, so nothing is allocated per line. Face corners that repeat a position,
+// texture coord and normal share one vertex, found through an open addressing hash table.
+// Corners without a normal get the area weighted normal of the faces around their vertex.
+class ObjLoader
+{
+public:
+	ObjLoader() : used(0), target(NULL) {}
+
+	bool load(const std::string &path, ObjMesh &mesh)
+	{
+		double start = glfwGetTime();
+		MappedFile file;
+		if (!file.open(path))
+		{
+			std::cout << "Failed to open mesh " << path << std::endl;
+			return false;
+		}
+		positions.clear();
+		texCoords.clear();
+		normals.clear();
+		generated.clear();
+		table.assign(1 << 16, Slot());
+		used = 0;
+		mesh.vertices.clear();
+		mesh.indices.clear();
+		target = &mesh;
+
+		const char *cursor = (const char *)file.data();
+		const char *end = cursor + file.size();
+		int line = 1;
+		for (; cursor < end; line++)
+		{
+			const char *lineEnd = (const char *)memchr(cursor, '\n', end - cursor);
+			if (lineEnd == NULL)
+				lineEnd = end;
+			if (!parseLine(skipSpace(cursor, lineEnd), lineEnd))
+			{
+				std::cout << "Failed to parse mesh " << path << " at line " << line << std::endl;
+				return false;
+			}
+			cursor = lineEnd + 1;
+		}
+
+		// normals of the corners that had none
+		for (size_t i = 0; i < generated.size(); i++)
+		{
+			if (!generated[i])
+				continue;
+			float *normal = &mesh.vertices[i * ObjMesh::STRIDE + 3];
+			glm::vec3 n(normal[0], normal[1], normal[2]);
+			float length = glm::length(n);
+			n = length > 0.0f ? n / length : glm::vec3(0.0f, 1.0f, 0.0f);
+			normal[0] = n.x;
+			normal[1] = n.y;
+			normal[2] = n.z;
+		}
+		mesh.min = glm::vec3(1e30f);
+		mesh.max = glm::vec3(-1e30f);
+		for (size_t i = 0; i < mesh.vertices.size(); i += ObjMesh::STRIDE)
+		{
+			glm::vec3 p(mesh.vertices[i], mesh.vertices[i + 1], mesh.vertices[i + 2]);
+			mesh.min = glm::min(mesh.min, p);
+			mesh.max = glm::max(mesh.max, p);
+		}
+		mesh.vertexCount = (int)(mesh.vertices.size() / ObjMesh::STRIDE);
+		mesh.triangleCount = (int)(mesh.indices.size() / 3);
+		mesh.fileBytes = file.size();
+		mesh.milliseconds = (glfwGetTime() - start) * 1000.0;
+		target = NULL;
+		return true;
+	}
+
+private:
+	// a distinct corner: indices into positions, texCoords and normals, plus one; 0 for none
+	struct Slot
+	{
+		int position, texCoord, normal;
+		unsigned int vertex;
+		Slot() : position(0), texCoord(0), normal(0), vertex(0) {}
+	};
+
+	std::vector<glm::vec3> positions, normals;
+	std::vector<glm::vec2> texCoords;
+	// whether the normal of a vertex is summed from its faces
+	std::vector<char> generated;
+	std::vector<Slot> table;
+	size_t used;
+	std::vector<unsigned int> face;
+	ObjMesh *target;
+
+	static const char *skipSpace(const char *p, const char *end)
+	{
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+			p++;
+		return p;
+	}
+
+	static bool isDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	// Decimal float with optional sign, fraction and exponent; NULL if there are no digits
+	static const char *parseFloat(const char *p, const char *end, float &value)
+	{
+		static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+		p = skipSpace(p, end);
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+		// 18 digits fit the integer exactly; further ones only move the decimal point
+		unsigned long long digits = 0;
+		int count = 0, scale = 0;
+		const char *first = p;
+		for (; p < end && isDigit(*p); p++)
+		{
+			if (count < 18)
+			{
+				digits = digits * 10 + (*p - '0');
+				count += digits != 0;
+			}
+			else
+			{
+				scale++;
+			}
+		}
+		if (p < end && *p == '.')
+		{
+			for (p++; p < end && isDigit(*p); p++)
+			{
+				if (count < 18)
+				{
+					digits = digits * 10 + (*p - '0');
+					count += digits != 0;
+					scale--;
+				}
+			}
+		}
+		if (p == first || (p == first + 1 && *first == '.'))
+			return NULL;
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			p++;
+			bool negativeExponent = false;
+			if (p < end && (*p == '-' || *p == '+'))
+				negativeExponent = *p++ == '-';
+			int exponent = 0;
+			for (; p < end && isDigit(*p); p++)
+				exponent = std::min(exponent * 10 + (*p - '0'), 1000);
+			scale += negativeExponent ? -exponent : exponent;
+		}
+		double result = (double)digits;
+		if (scale < 0)
+			result = scale >= -22 ? result / powers[-scale] : result * std::pow(10.0, scale);
+		else if (scale > 0)
+			result = scale <= 22 ? result * powers[scale] : result * std::pow(10.0, scale);
+		value = (float)(negative ? -result : result);
+		return p;
+	}
+
+	static const char *parseInt(const char *p, const char *end, int &value)
+	{
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+		const char *first = p;
+		int result = 0;
+		for (; p < end && isDigit(*p); p++)
+			result = result * 10 + (*p - '0');
+		if (p == first)
+			return NULL;
+		value = negative ? -result : result;
+		return p;
+	}
+
+	// An OBJ index, 1 based or negative from the end, as an index plus one; 0 if out of range
+	static int resolve(int index, size_t count)
+	{
+		if (index < 0)
+			index += (int)count + 1;
+		return index >= 1 && index <= (int)count ? index : 0;
+	}
+
+	bool parseLine(const char *p, const char *end)
+	{
+		const char *word = p;
+		while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+			p++;
+		size_t length = p - word;
+		if (length == 0)
+			return true;
+		if (word[0] == 'v' && (length == 1 || (length == 2 && (word[1] == 't' || word[1] == 'n'))))
+		{
+			// a third texture coord and vertex colors after the position are ignored; texture
+			// coords need only u, a missing v is 0
+			float value[3] = { 0.0f, 0.0f, 0.0f };
+			bool texCoord = length == 2 && word[1] == 't';
+			int count = texCoord ? 2 : 3, required = texCoord ? 1 : 3;
+			for (int i = 0; i < count; i++)
+			{
+				if (i >= required)
+				{
+					p = skipSpace(p, end);
+					if (p == end || *p == '#')
+						break;
+				}
+				p = parseFloat(p, end, value[i]);
+				if (p == NULL)
+					return false;
+			}
+			if (length == 1)
+				positions.push_back(glm::vec3(value[0], value[1], value[2]));
+			else if (word[1] == 't')
+				texCoords.push_back(glm::vec2(value[0], value[1]));
+			else
+				normals.push_back(glm::vec3(value[0], value[1], value[2]));
+			return true;
+		}
+		if (length != 1 || word[0] != 'f')
+			return true;
+		face.clear();
+		for (p = skipSpace(p, end); p < end; p = skipSpace(p, end))
+		{
+			int position = 0, texCoord = 0, normal = 0;
+			p = parseInt(p, end, position);
+			if (p == NULL)
+				return false;
+			if (p < end && *p == '/')
+			{
+				p++;
+				if (p < end && *p != '/')
+				{
+					p = parseInt(p, end, texCoord);
+					if (p == NULL)
+						return false;
+				}
+				if (p < end && *p == '/')
+				{
+					p = parseInt(p + 1, end, normal);
+					if (p == NULL)
+						return false;
+				}
+			}
+			position = resolve(position, positions.size());
+			if (position == 0)
+				return false;
+			texCoord = texCoord != 0 ? resolve(texCoord, texCoords.size()) : 0;
+			normal = normal != 0 ? resolve(normal, normals.size()) : 0;
+			face.push_back(vertexOf(position, texCoord, normal));
+		}
+		if (face.size() < 3)
+			return false;
+		for (size_t i = 1; i + 1 < face.size(); i++)
+		{
+			unsigned int triangle[3] = { face[0], face[i], face[i + 1] };
+			target->indices.insert(target->indices.end(), triangle, triangle + 3);
+			addFaceNormal(triangle);
+		}
+		return true;
+	}
+
+	static size_t hash(int position, int texCoord, int normal)
+	{
+		unsigned long long h = (unsigned long long)(unsigned int)position * 0x9E3779B97F4A7C15ull;
+		h ^= (unsigned long long)(unsigned int)texCoord * 0xC2B2AE3D27D4EB4Full + (h << 6) + (h >> 2);
+		h ^= (unsigned long long)(unsigned int)normal * 0x165667B19E3779F9ull + (h << 6) + (h >> 2);
+		return (size_t)(h ^ (h >> 29));
+	}
+
+	// The slot of a corner, or the empty slot where it belongs
+	Slot &find(int position, int texCoord, int normal)
+	{
+		size_t mask = table.size() - 1;
+		for (size_t i = hash(position, texCoord, normal) & mask;; i = (i + 1) & mask)
+		{
+			Slot &slot = table[i];
+			if (slot.position == 0 || (slot.position == position && slot.texCoord == texCoord && slot.normal == normal))
+				return slot;
+		}
+	}
+
+	// Doubles the table, which is kept at most half full
+	void grow()
+	{
+		std::vector<Slot> old(table.size() * 2);
+		old.swap(table);
+		for (size_t i = 0; i < old.size(); i++)
+		{
+			if (old[i].position != 0)
+				find(old[i].position, old[i].texCoord, old[i].normal) = old[i];
+		}
+	}
+
+	// The vertex of a corner, added the first time the corner is seen
+	unsigned int vertexOf(int position, int texCoord, int normal)
+	{
+		if ((used + 1) * 2 > table.size())
+			grow();
+		Slot &slot = find(position, texCoord, normal);
+		if (slot.position != 0)
+			return slot.vertex;
+		slot.position = position;
+		slot.texCoord = texCoord;
+		slot.normal = normal;
+		slot.vertex = (unsigned int)generated.size();
+		used++;
+		const glm::vec3 &p = positions[position - 1];
+		glm::vec3 n = normal != 0 ? normals[normal - 1] : glm::vec3(0.0f);
+		glm::vec2 t = texCoord != 0 ? texCoords[texCoord - 1] : glm::vec2(0.0f);
+		float vertex[ObjMesh::STRIDE] = { p.x, p.y, p.z, n.x, n.y, n.z, t.x, t.y };
+		target->vertices.insert(target->vertices.end(), vertex, vertex + ObjMesh::STRIDE);
+		generated.push_back(normal == 0);
+		return slot.vertex;
+	}
+
+	// Adds the area weighted normal of a triangle to its corners that had none
+	void addFaceNormal(const unsigned int triangle[3])
+	{
+		if (!generated[triangle[0]] && !generated[triangle[1]] && !generated[triangle[2]])
+			return;
+		float *vertices = target->vertices.data();
+		glm::vec3 corners[3];
+		for (int k = 0; k < 3; k++)
+		{
+			const float *v = vertices + triangle[k] * ObjMesh::STRIDE;
+			corners[k] = glm::vec3(v[0], v[1], v[2]);
+		}
+		glm::vec3 normal = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+		for (int k = 0; k < 3; k++)
+		{
+			if (!generated[triangle[k]])
+				continue;
+			float *n = vertices + triangle[k] * ObjMesh::STRIDE + 3;
+			n[0] += normal.x;
+			n[1] += normal.y;
+			n[2] += normal.z;
+		}
+	}
+};
+
+#endif
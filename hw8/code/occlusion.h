@@ -0,0 +1,265 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "glstate.h"
+#include "glextensions.h"
+#include "shader.h"
+#include "mesh.h"
+#include "bvh.h"
+
+#include <vector>
+#include <deque>
+
+// Occlusion culling with hardware queries on bounding boxes, after CHC++. The objects that were
+// visible are drawn directly; then, with the depth buffer of the pass filled, the boxes of the
+// objects that were hidden are tested first, and those of visible objects every few frames.
+// Results are read a frame or more later, and only once the GPU has them, so the CPU never
+// waits for a query. The price is that an object coming into view appears a frame late;
+// objects entering the frustum count as visible until a query says otherwise.
+class OcclusionCuller
+{
+public:
+	// queries issued per frame at most; hidden objects may take three quarters of them
+	static const int QUERY_BUDGET = 4096;
+	// frames between the tests of an object that stays visible
+	static const unsigned int VISIBLE_INTERVAL = 8;
+
+	OcclusionCuller() : shader(NULL), box(0), frame(0), lastQueries(0), lastHidden(0) {}
+
+	// Forgets what is known about the objects, for a scene of count objects
+	void reset(size_t count)
+	{
+		objects.assign(count, ObjectState());
+		// queries in flight are still read back, then dropped
+		for (size_t i = 0; i < pending.size(); i++)
+			pending[i].object = NONE;
+	}
+
+	// Reads the results the GPU has finished, oldest first, up to the first it has not
+	void collect()
+	{
+		while (!pending.empty())
+		{
+			const PendingQuery &query = pending.front();
+			GLuint available = GL_FALSE;
+			glGetQueryObjectuiv(query.id, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available == GL_FALSE)
+				break;
+			GLuint samples = 0;
+			glGetQueryObjectuiv(query.id, GL_QUERY_RESULT, &samples);
+			if (query.object != NONE)
+			{
+				objects[query.object].visible = samples != 0;
+				objects[query.object].pending = false;
+			}
+			freeQueries.push_back(query.id);
+			pending.pop_front();
+		}
+	}
+
+	// Appends the objects inside the frustum that are to be drawn, and picks the ones query
+	// tests afterwards. Called once a frame, with the objects that passed frustum culling.
+	void filter(const std::vector<unsigned int> &candidates, std::vector<unsigned int> &draw)
+	{
+		frame++;
+		hiddenTests.clear();
+		visibleTests.clear();
+		lastHidden = 0;
+		for (size_t i = 0; i < candidates.size(); i++)
+		{
+			unsigned int id = candidates[i];
+			ObjectState &object = objects[id];
+			// nothing is known about an object that was outside the frustum
+			bool entered = object.seen + 1 != frame;
+			object.seen = frame;
+			if (entered)
+				object.visible = true;
+			if (object.visible)
+			{
+				draw.push_back(id);
+				// spread over the frames, so the tests of visible objects come in even batches
+				if (!object.pending && (entered || (frame + id) % VISIBLE_INTERVAL == 0))
+					visibleTests.push_back(id);
+			}
+			else
+			{
+				lastHidden++;
+				if (!object.pending)
+					hiddenTests.push_back(id);
+			}
+		}
+	}
+
+	// Tests the boxes picked by filter against the bound depth buffer, which must hold what was
+	// drawn this frame. nearPlane is the near distance of the projection.
+	void query(const glm::mat4 &viewProjection, const glm::vec3 &eye, float nearPlane, const std::vector<Bounds> &boxes)
+	{
+		lastQueries = 0;
+		if (!prepare())
+			return;
+		shader->use();
+		viewProjectionUniform.set(viewProjection);
+		bool culling = glState().isEnabled(GL_CULL_FACE);
+		glState().disable(GL_CULL_FACE);
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glDepthMask(GL_FALSE);
+		GLenum target = glExtensions().conservativeOcclusion ? GL_ANY_SAMPLES_PASSED_CONSERVATIVE : GL_ANY_SAMPLES_PASSED;
+		for (size_t i = 0; i < hiddenTests.size() && lastQueries < QUERY_BUDGET * 3 / 4; i++)
+			test(target, hiddenTests[i], boxes[hiddenTests[i]], eye, nearPlane);
+		for (size_t i = 0; i < visibleTests.size() && lastQueries < QUERY_BUDGET; i++)
+			test(target, visibleTests[i], boxes[visibleTests[i]], eye, nearPlane);
+		glDepthMask(GL_TRUE);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		if (culling)
+			glState().enable(GL_CULL_FACE);
+	}
+
+	void release()
+	{
+		delete shader;
+		shader = NULL;
+		// the next program is resolved afresh, prepare only does that for unset handles
+		viewProjectionUniform = Uniform<glm::mat4>();
+		boxMinUniform = boxSizeUniform = Uniform<glm::vec3>();
+		if (box != 0)
+			meshRegistry().release(box);
+		box = 0;
+		// the results of queries in flight are not needed any more
+		for (size_t i = 0; i < pending.size(); i++)
+			freeQueries.push_back(pending[i].id);
+		if (!freeQueries.empty())
+			glDeleteQueries((GLsizei)freeQueries.size(), freeQueries.data());
+		freeQueries.clear();
+		pending.clear();
+		objects.clear();
+	}
+
+	// Counts of the last frame
+	int queries() const
+	{
+		return lastQueries;
+	}
+
+	int hidden() const
+	{
+		return lastHidden;
+	}
+
+	int inFlight() const
+	{
+		return (int)pending.size();
+	}
+
+private:
+	static const unsigned int NONE = 0xFFFFFFFF;
+
+	struct ObjectState
+	{
+		// frame the object was last inside the frustum
+		unsigned int seen;
+		bool visible, pending;
+		ObjectState() : seen(0), visible(true), pending(false) {}
+	};
+
+	struct PendingQuery
+	{
+		GLuint id;
+		unsigned int object;
+	};
+
+	Shader *shader;
+	Uniform<glm::mat4> viewProjectionUniform;
+	Uniform<glm::vec3> boxMinUniform, boxSizeUniform;
+	MeshHandle box;
+	unsigned int frame;
+	int lastQueries, lastHidden;
+	std::vector<ObjectState> objects;
+	std::vector<unsigned int> hiddenTests, visibleTests;
+	std::deque<PendingQuery> pending;
+	std::vector<GLuint> freeQueries;
+
+	// Builds the box program and mesh on first use; false while the program still compiles
+	bool prepare()
+	{
+		static const char *box_vs = "#version 330 core\n"
+			"layout (location = 0) in vec3 position;\n"
+			"uniform mat4 viewProjection;\n"
+			"uniform vec3 boxMin;\n"
+			"uniform vec3 boxSize;\n"
+			"void main()\n"
+			"{\n"
+			"   gl_Position = viewProjection * vec4(boxMin + position * boxSize, 1.0f);\n"
+			"}\0";
+		static const char *box_fs = "#version 330 core\n"
+			"void main()\n"
+			"{\n"
+			"}\n\0";
+		if (shader == NULL)
+		{
+			shader = new Shader(box_vs, box_fs, nullptr, true);
+			// the unit cube, corner i at (i & 1, i >> 1 & 1, i >> 2)
+			float corners[24];
+			for (int i = 0; i < 8; i++)
+			{
+				corners[i * 3] = (float)(i & 1);
+				corners[i * 3 + 1] = (float)((i >> 1) & 1);
+				corners[i * 3 + 2] = (float)(i >> 2);
+			}
+			static const unsigned int faces[36] = {
+				0, 2, 1, 1, 2, 3, 4, 5, 6, 5, 7, 6,
+				0, 1, 4, 1, 5, 4, 2, 6, 3, 3, 6, 7,
+				0, 4, 2, 2, 4, 6, 1, 3, 5, 3, 7, 5
+			};
+			box = meshRegistry().create(corners, sizeof(corners), faces, sizeof(faces), 3, { { 0, 3, 0 } });
+		}
+		if (!shader->ready())
+			return false;
+		if (viewProjectionUniform.location == -1)
+		{
+			viewProjectionUniform = shader->uniform<glm::mat4>("viewProjection");
+			boxMinUniform = shader->uniform<glm::vec3>("boxMin");
+			boxSizeUniform = shader->uniform<glm::vec3>("boxSize");
+		}
+		return true;
+	}
+
+	void test(GLenum target, unsigned int id, const Bounds &bounds, const glm::vec3 &eye, float nearPlane)
+	{
+		// grown a little, so a visible object does not hide its own box
+		glm::vec3 margin = (bounds.max - bounds.min) * 0.01f + 0.001f;
+		glm::vec3 low = bounds.min - margin, high = bounds.max + margin;
+		// the near plane would cut away the faces of a box around the eye; twice its distance
+		// covers the corners of the near plane for fields of view up to about 100 degrees
+		float reach = 2.0f * nearPlane;
+		if (eye.x > low.x - reach && eye.y > low.y - reach && eye.z > low.z - reach
+			&& eye.x < high.x + reach && eye.y < high.y + reach && eye.z < high.z + reach)
+		{
+			objects[id].visible = true;
+			return;
+		}
+		GLuint query;
+		if (freeQueries.empty())
+		{
+			glGenQueries(1, &query);
+		}
+		else
+		{
+			query = freeQueries.back();
+			freeQueries.pop_back();
+		}
+		boxMinUniform.set(low);
+		boxSizeUniform.set(high - low);
+		glBeginQuery(target, query);
+		meshRegistry().get(box).draw();
+		glEndQuery(target);
+		objects[id].pending = true;
+		PendingQuery entry = { query, id };
+		pending.push_back(entry);
+		lastQueries++;
+	}
+};
+
+#endif
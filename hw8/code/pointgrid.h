@@ -0,0 +1,101 @@
+#ifndef POINTGRID_H
+#define POINTGRID_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+// Uniform grid over a 2D rectangle that buckets point indices by cell, used for picking.
+// Insert, remove and move only touch one or two cells, and a nearest-point query only visits
+// the cells overlapping the pick radius, so hit-testing is O(1) on average for evenly spread points.
+// Points outside the rectangle are clamped into the border cells.
+class PointGrid
+{
+public:
+	PointGrid(glm::vec2 minCorner = glm::vec2(-1.0f), glm::vec2 maxCorner = glm::vec2(1.0f), int resolution = 64)
+		: Min(minCorner), Resolution(resolution), cells(resolution * resolution)
+	{
+		CellSize = (maxCorner - minCorner) / (float)resolution;
+	}
+
+	void clear()
+	{
+		for (size_t i = 0; i < cells.size(); i++)
+			cells[i].clear();
+	}
+
+	void insert(int index, glm::vec2 position)
+	{
+		cells[cellOf(position)].push_back(index);
+	}
+
+	void remove(int index, glm::vec2 position)
+	{
+		std::vector<int> &cell = cells[cellOf(position)];
+		std::vector<int>::iterator it = std::find(cell.begin(), cell.end(), index);
+		if (it != cell.end())
+		{
+			*it = cell.back();
+			cell.pop_back();
+		}
+	}
+
+	void move(int index, glm::vec2 from, glm::vec2 to)
+	{
+		if (cellOf(from) == cellOf(to))
+			return;
+		remove(index, from);
+		insert(index, to);
+	}
+
+	// Returns the index of the point closest to position within radius, or -1 if there is none
+	int nearest(const std::vector<glm::vec2> &points, glm::vec2 position, float radius) const
+	{
+		int x0, y0, x1, y1;
+		cellCoord(position - glm::vec2(radius), x0, y0);
+		cellCoord(position + glm::vec2(radius), x1, y1);
+		int best = -1;
+		float bestDistance = radius * radius;
+		for (int y = y0; y <= y1; y++)
+		{
+			for (int x = x0; x <= x1; x++)
+			{
+				const std::vector<int> &cell = cells[y * Resolution + x];
+				for (size_t i = 0; i < cell.size(); i++)
+				{
+					glm::vec2 d = points[cell[i]] - position;
+					float distance = glm::dot(d, d);
+					if (distance <= bestDistance)
+					{
+						bestDistance = distance;
+						best = cell[i];
+					}
+				}
+			}
+		}
+		return best;
+	}
+
+private:
+	glm::vec2 Min;
+	glm::vec2 CellSize;
+	int Resolution;
+	std::vector<std::vector<int> > cells;
+
+	void cellCoord(glm::vec2 position, int &x, int &y) const
+	{
+		x = std::min(std::max((int)std::floor((position.x - Min.x) / CellSize.x), 0), Resolution - 1);
+		y = std::min(std::max((int)std::floor((position.y - Min.y) / CellSize.y), 0), Resolution - 1);
+	}
+
+	int cellOf(glm::vec2 position) const
+	{
+		int x, y;
+		cellCoord(position, x, y);
+		return y * Resolution + x;
+	}
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <cstring>
+
+// CPU time of named sections of the frame. Sections add to the current frame as often as they
+// run; beginFrame closes the frame and keeps its totals with a running average. Names must be
+// string literals, they are kept by pointer.
+class Profiler
+{
+public:
+	struct Section
+	{
+		const char *name;
+		double milliseconds, average;
+		int calls;
+	};
+
+	void add(const char *name, double milliseconds)
+	{
+		Entry &entry = find(name);
+		entry.current += milliseconds;
+		entry.currentCalls++;
+	}
+
+	void beginFrame()
+	{
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			Entry &entry = entries[i];
+			entry.section.milliseconds = entry.current;
+			entry.section.calls = entry.currentCalls;
+			entry.section.average = entry.section.average * 0.95 + entry.current * 0.05;
+			entry.current = 0.0;
+			entry.currentCalls = 0;
+		}
+	}
+
+	int count() const
+	{
+		return (int)entries.size();
+	}
+
+	// Totals of the last complete frame
+	const Section &section(int i) const
+	{
+		return entries[i].section;
+	}
+
+private:
+	struct Entry
+	{
+		Section section;
+		double current;
+		int currentCalls;
+	};
+
+	std::vector<Entry> entries;
+
+	Entry &find(const char *name)
+	{
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			if (entries[i].section.name == name || strcmp(entries[i].section.name, name) == 0)
+				return entries[i];
+		}
+		Entry entry = { { name, 0.0, 0.0, 0 }, 0.0, 0 };
+		entries.push_back(entry);
+		return entries.back();
+	}
+};
+
+inline Profiler &profiler()
+{
+	static Profiler instance;
+	return instance;
+}
+
+// Times the enclosing block into a profiler section
+class ProfileScope
+{
+public:
+	explicit ProfileScope(const char *name) : name(name), start(glfwGetTime()) {}
+
+	~ProfileScope()
+	{
+		profiler().add(name, (glfwGetTime() - start) * 1000.0);
+	}
+
+private:
+	const char *name;
+	double start;
+	ProfileScope(const ProfileScope &);
+	ProfileScope &operator=(const ProfileScope &);
+};
+
+#endif
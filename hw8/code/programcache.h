@@ -0,0 +1,158 @@
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include "glextensions.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// On-disk cache of linked programs. A program is keyed by a hash of its shader sources and
+// of the GL renderer and version strings, so a driver update invalidates old binaries.
+// Files are shadercache/<key>.bin: the binary format as a 32-bit value, then the binary.
+class ProgramCache
+{
+public:
+	ProgramCache() : hits(0), misses(0), rejected(0), seconds(0.0) {}
+
+	static unsigned long long key(const char *vertexCode, const char *fragmentCode, const char *geometryCode)
+	{
+		// FNV-1a over every source, each terminated by its NUL so that boundaries count
+		unsigned long long hash = 14695981039346656037ull;
+		const char *parts[5] = { vertexCode, fragmentCode, geometryCode,
+			(const char *)glGetString(GL_RENDERER), (const char *)glGetString(GL_VERSION) };
+		for (int i = 0; i < 5; i++)
+		{
+			const char *p = parts[i] != NULL ? parts[i] : "";
+			do
+			{
+				hash ^= (unsigned char)*p;
+				hash *= 1099511628211ull;
+			} while (*p++ != '\0');
+		}
+		return hash;
+	}
+
+	// Creates a program from its cached binary, or returns 0 if there is none or the driver rejects it
+	GLuint load(unsigned long long key)
+	{
+		if (!glExtensions().programBinary)
+			return 0;
+		double start = glfwGetTime();
+		std::ifstream file(path(key).c_str(), std::ios::binary);
+		if (!file)
+			return 0;
+		unsigned int format = 0;
+		file.read((char *)&format, sizeof(format));
+		if (!file)
+			return 0;
+		// istreambuf_iterator reads the buffer directly and never sets eofbit, only badbit on errors
+		std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		if (file.bad() || binary.empty())
+			return 0;
+		GLuint program = glCreateProgram();
+		glExtensions().loadProgramBinary(program, format, binary.data(), (GLsizei)binary.size());
+		GLint success = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			// stale or foreign binary: drop it and let the caller compile
+			glDeleteProgram(program);
+			std::remove(path(key).c_str());
+			rejected++;
+			return 0;
+		}
+		hits++;
+		seconds += glfwGetTime() - start;
+		return program;
+	}
+
+	// Call before linking a program that will be stored
+	void prepare(GLuint program)
+	{
+		if (glExtensions().programBinary)
+			glExtensions().programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
+	// Writes the binary of a freshly linked program; compileSeconds is the time it took to build
+	void store(unsigned long long key, GLuint program, double compileSeconds)
+	{
+		misses++;
+		seconds += compileSeconds;
+		GLint linked = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if (!glExtensions().programBinary || !linked)
+			return;
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return;
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		glExtensions().getProgramBinary(program, length, NULL, &format, binary.data());
+#ifdef _WIN32
+		_mkdir(directory());
+#else
+		mkdir(directory(), 0755);
+#endif
+		std::ofstream file(path(key).c_str(), std::ios::binary);
+		unsigned int format32 = format;
+		file.write((const char *)&format32, sizeof(format32));
+		file.write(binary.data(), binary.size());
+	}
+
+	int cachedPrograms() const
+	{
+		return hits;
+	}
+
+	int compiledPrograms() const
+	{
+		return misses;
+	}
+
+	int rejectedBinaries() const
+	{
+		return rejected;
+	}
+
+	// Time spent creating programs, whether loaded or compiled
+	double milliseconds() const
+	{
+		return seconds * 1000.0;
+	}
+
+private:
+	int hits, misses, rejected;
+	double seconds;
+
+	static const char *directory()
+	{
+		return "shadercache";
+	}
+
+	static std::string path(unsigned long long key)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.bin", key);
+		return std::string(directory()) + "/" + name;
+	}
+};
+
+inline ProgramCache &programCache()
+{
+	static ProgramCache cache;
+	return cache;
+}
+
+#endif
@@ -0,0 +1,209 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include "glstate.h"
+#include "mesh.h"
+
+#include <vector>
+#include <algorithm>
+
+// One draw of a mesh with the state it needs. Textures go to units 0 and 1, 0 leaves a unit
+// alone; depth is the view distance scaled to [0, 1] and orders draws front to back.
+struct DrawCommand
+{
+	GLuint program;
+	GLuint textures[2];
+	MeshHandle mesh;
+	bool instanced;
+	float depth;
+};
+
+// Collects the draws of a frame and runs them in the order of a 64 bit key per draw:
+//   pass (4 bits) | program (12) | textures (16) | VAO (12) | depth (20), most significant first
+// so each pass sets up once and programs, textures and VAOs change as rarely as possible.
+// The keys are radix sorted a byte at a time. Programs, texture pairs and VAOs get small ids
+// in the order they are first submitted in a frame, which is what the key fields hold.
+class RenderQueue
+{
+public:
+	RenderQueue() : lastDraws(0), lastSortMicroseconds(0.0)
+	{
+		for (int i = 0; i < SWITCH_KINDS; i++)
+			lastSwitches[i] = lastUnsorted[i] = 0;
+	}
+
+	void submit(int pass, const DrawCommand &command)
+	{
+		unsigned long long key = 0;
+		key |= (unsigned long long)(pass & 0xF) << 60;
+		key |= (unsigned long long)slot(programs, command.program, 0xFFF) << 48;
+		key |= (unsigned long long)slot(textures, ((unsigned long long)command.textures[0] << 32) | command.textures[1], 0xFFFF) << 32;
+		key |= (unsigned long long)slot(vertexArrays, meshRegistry().get(command.mesh).VAO, 0xFFF) << 20;
+		float depth = std::min(1.0f, std::max(0.0f, command.depth));
+		key |= (unsigned long long)(depth * 0xFFFFF);
+		SortItem item = { key, (unsigned int)commands.size() };
+		items.push_back(item);
+		commands.push_back(command);
+	}
+
+	// Sorts and runs every submitted draw, then empties the queue. beginPass is called before
+	// the first draw of each pass, to bind its framebuffer and clear it.
+	void execute(void (*beginPass)(int pass))
+	{
+		double start = glfwGetTime();
+		countSwitches(lastUnsorted);
+		sort();
+		lastSortMicroseconds = (glfwGetTime() - start) * 1e6;
+		countSwitches(lastSwitches);
+
+		int pass = -1;
+		for (size_t i = 0; i < items.size(); i++)
+		{
+			const DrawCommand &command = commands[items[i].index];
+			int itemPass = (int)(items[i].key >> 60);
+			if (itemPass != pass)
+			{
+				pass = itemPass;
+				beginPass(pass);
+			}
+			glState().useProgram(command.program);
+			for (int unit = 0; unit < 2; unit++)
+			{
+				if (command.textures[unit] == 0)
+					continue;
+				glState().activeTexture(GL_TEXTURE0 + unit);
+				glState().bindTexture(GL_TEXTURE_2D, command.textures[unit]);
+			}
+			const Mesh &mesh = meshRegistry().get(command.mesh);
+			if (command.instanced)
+				mesh.drawInstanced();
+			else
+				mesh.draw();
+		}
+		lastDraws = (int)items.size();
+		commands.clear();
+		items.clear();
+		programs.clear();
+		textures.clear();
+		vertexArrays.clear();
+	}
+
+	// Counts of the last execute
+	int draws() const
+	{
+		return lastDraws;
+	}
+
+	// Program, texture and VAO changes between consecutive draws as they ran
+	int programSwitches() const
+	{
+		return lastSwitches[PROGRAM];
+	}
+
+	int textureSwitches() const
+	{
+		return lastSwitches[TEXTURE];
+	}
+
+	int vertexArraySwitches() const
+	{
+		return lastSwitches[VERTEX_ARRAY];
+	}
+
+	// All changes the draws would have caused in the order they were submitted
+	int unsortedSwitches() const
+	{
+		return lastUnsorted[PROGRAM] + lastUnsorted[TEXTURE] + lastUnsorted[VERTEX_ARRAY];
+	}
+
+	double sortMilliseconds() const
+	{
+		return lastSortMicroseconds / 1000.0;
+	}
+
+private:
+	struct SortItem
+	{
+		unsigned long long key;
+		unsigned int index;
+	};
+
+	enum
+	{
+		PROGRAM,
+		TEXTURE,
+		VERTEX_ARRAY,
+		SWITCH_KINDS
+	};
+
+	std::vector<DrawCommand> commands;
+	std::vector<SortItem> items, scratch;
+	std::vector<unsigned long long> programs, textures, vertexArrays;
+	int lastDraws;
+	int lastSwitches[SWITCH_KINDS], lastUnsorted[SWITCH_KINDS];
+	double lastSortMicroseconds;
+
+	// The id of a value in the frame's table; values past the field's range share its last id
+	static unsigned int slot(std::vector<unsigned long long> &table, unsigned long long value, unsigned int limit)
+	{
+		for (size_t i = 0; i < table.size(); i++)
+		{
+			if (table[i] == value)
+				return std::min((unsigned int)i, limit);
+		}
+		table.push_back(value);
+		return std::min((unsigned int)table.size() - 1, limit);
+	}
+
+	// LSD radix sort on bytes; bytes that are equal in every key are skipped
+	void sort()
+	{
+		scratch.resize(items.size());
+		for (int shift = 0; shift < 64; shift += 8)
+		{
+			size_t counts[256] = {};
+			for (size_t i = 0; i < items.size(); i++)
+				counts[(items[i].key >> shift) & 0xFF]++;
+			if (items.empty() || counts[(items[0].key >> shift) & 0xFF] == items.size())
+				continue;
+			size_t offset = 0;
+			for (int b = 0; b < 256; b++)
+			{
+				size_t count = counts[b];
+				counts[b] = offset;
+				offset += count;
+			}
+			for (size_t i = 0; i < items.size(); i++)
+				scratch[counts[(items[i].key >> shift) & 0xFF]++] = items[i];
+			items.swap(scratch);
+		}
+	}
+
+	void countSwitches(int switches[SWITCH_KINDS]) const
+	{
+		for (int i = 0; i < SWITCH_KINDS; i++)
+			switches[i] = 0;
+		for (size_t i = 1; i < items.size(); i++)
+		{
+			unsigned long long previous = items[i - 1].key, current = items[i].key;
+			if (((previous ^ current) >> 48) & 0xFFF)
+				switches[PROGRAM]++;
+			if (((previous ^ current) >> 32) & 0xFFFF)
+				switches[TEXTURE]++;
+			if (((previous ^ current) >> 20) & 0xFFF)
+				switches[VERTEX_ARRAY]++;
+		}
+	}
+};
+
+// The queue shared by all homework modules
+inline RenderQueue &renderQueue()
+{
+	static RenderQueue queue;
+	return queue;
+}
+
+#endif
@@ -4,124 +4,260 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include "glstate.h"
+#include "uniformblocks.h"
+#include "programcache.h"
+
 #include <string>
+#include <unordered_map>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
+// value upload for each uniform type a Uniform handle can hold
+inline void uniformValue(GLint location, bool value) { glUniform1i(location, (int)value); }
+inline void uniformValue(GLint location, int value) { glUniform1i(location, value); }
+inline void uniformValue(GLint location, float value) { glUniform1f(location, value); }
+inline void uniformValue(GLint location, const glm::vec2 &value) { glUniform2fv(location, 1, &value[0]); }
+inline void uniformValue(GLint location, const glm::vec3 &value) { glUniform3fv(location, 1, &value[0]); }
+inline void uniformValue(GLint location, const glm::vec4 &value) { glUniform4fv(location, 1, &value[0]); }
+inline void uniformValue(GLint location, const glm::mat2 &mat) { glUniformMatrix2fv(location, 1, GL_FALSE, &mat[0][0]); }
+inline void uniformValue(GLint location, const glm::mat3 &mat) { glUniformMatrix3fv(location, 1, GL_FALSE, &mat[0][0]); }
+inline void uniformValue(GLint location, const glm::mat4 &mat) { glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]); }
+
+// A uniform location resolved once, typed so that set() needs no name and no lookup.
+// Setting an inactive uniform (location -1) is ignored by GL, like with glGetUniformLocation.
+template <typename T>
+struct Uniform
+{
+	GLint location;
+
+	Uniform() : location(-1) {}
+	explicit Uniform(GLint location) : location(location) {}
+
+	void set(const T &value) const
+	{
+		uniformValue(location, value);
+	}
+};
+
 class Shader
 {
 public:
 	unsigned int ID;
-	// constructor generates the shader on the fly
+	// constructor loads the program from the program cache, or generates it on the fly.
+	// A deferred shader only submits the compile; poll ready() before using it, which lets
+	// drivers with KHR_parallel_shader_compile build it on their own threads meanwhile.
 	// ------------------------------------------------------------------------
-	Shader(const char* vertexCode, const char* fragmentCode, const char* geometryCode = nullptr)
+	Shader(const char* vertexCode, const char* fragmentCode, const char* geometryCode = nullptr, bool deferred = false)
+		: vertex(0), fragment(0), geometry(0), pending(false), prepared(false)
 	{
-		const char* vShaderCode = vertexCode;
-		const char * fShaderCode = fragmentCode;
-		// 2. compile shaders
-		unsigned int vertex, fragment;
-		// vertex shader
-		vertex = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vertex, 1, &vShaderCode, NULL);
-		glCompileShader(vertex);
-		checkCompileErrors(vertex, "VERTEX");
-		// fragment Shader
-		fragment = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fragment, 1, &fShaderCode, NULL);
-		glCompileShader(fragment);
-		checkCompileErrors(fragment, "FRAGMENT");
-		// if geometry shader is given, compile geometry shader
-		unsigned int geometry;
-		if (geometryCode != nullptr)
+		key = ProgramCache::key(vertexCode, fragmentCode, geometryCode);
+		ID = programCache().load(key);
+		if (ID == 0)
 		{
-			const char * gShaderCode = geometryCode;
-			geometry = glCreateShader(GL_GEOMETRY_SHADER);
-			glShaderSource(geometry, 1, &gShaderCode, NULL);
-			glCompileShader(geometry);
-			checkCompileErrors(geometry, "GEOMETRY");
+			start = glfwGetTime();
+			compile(vertexCode, fragmentCode, geometryCode);
+			pending = true;
 		}
-		// shader Program
-		ID = glCreateProgram();
-		glAttachShader(ID, vertex);
-		glAttachShader(ID, fragment);
-		if (geometryCode != nullptr)
-			glAttachShader(ID, geometry);
-		glLinkProgram(ID);
-		checkCompileErrors(ID, "PROGRAM");
-		// delete the shaders as they're linked into our program now and no longer necessery
-		glDeleteShader(vertex);
-		glDeleteShader(fragment);
-		if (geometryCode != nullptr)
-			glDeleteShader(geometry);
-
+		if (!deferred)
+			ready();
+	}
+	// the program is owned by the object, so it cannot be copied
+	Shader(const Shader &) = delete;
+	Shader &operator=(const Shader &) = delete;
+	~Shader()
+	{
+		if (pending)
+		{
+			glDeleteShader(vertex);
+			glDeleteShader(fragment);
+			if (geometry != 0)
+				glDeleteShader(geometry);
+		}
+		glDeleteProgram(ID);
+		// the cache may still hold the deleted program as current
+		glState().invalidate();
+	}
+	// true once the program is linked and its uniforms are known; does not block while
+	// the driver is still compiling it in parallel
+	// ------------------------------------------------------------------------
+	bool ready()
+	{
+		if (pending)
+		{
+			if (glExtensions().parallelShaderCompile)
+			{
+				GLint done = GL_FALSE;
+				glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &done);
+				if (done == GL_FALSE)
+					return false;
+			}
+			checkCompileErrors(vertex, "VERTEX");
+			checkCompileErrors(fragment, "FRAGMENT");
+			if (geometry != 0)
+				checkCompileErrors(geometry, "GEOMETRY");
+			checkCompileErrors(ID, "PROGRAM");
+			// delete the shaders as they're linked into our program now and no longer necessery
+			glDeleteShader(vertex);
+			glDeleteShader(fragment);
+			if (geometry != 0)
+				glDeleteShader(geometry);
+			vertex = fragment = geometry = 0;
+			programCache().store(key, ID, glfwGetTime() - start);
+			pending = false;
+		}
+		if (!prepared)
+		{
+			bindUniformBlocks(ID);
+			reflectUniforms();
+			prepared = true;
+		}
+		return true;
 	}
 	// activate the shader
 	// ------------------------------------------------------------------------
 	void use()
 	{
-		glUseProgram(ID);
+		glState().useProgram(ID);
+	}
+	// location of an active uniform from the table built at link time, -1 if there is none
+	// ------------------------------------------------------------------------
+	GLint location(const std::string &name) const
+	{
+		std::unordered_map<std::string, GLint>::const_iterator it = uniforms.find(name);
+		return it != uniforms.end() ? it->second : -1;
+	}
+	// typed handle for per-frame uniforms; resolve it once and keep it
+	// ------------------------------------------------------------------------
+	template <typename T>
+	Uniform<T> uniform(const std::string &name) const
+	{
+		return Uniform<T>(location(name));
 	}
 	// utility uniform functions
 	// ------------------------------------------------------------------------
 	void setBool(const std::string &name, bool value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		glUniform1i(location(name), (int)value);
 	}
 	// ------------------------------------------------------------------------
 	void setInt(const std::string &name, int value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		glUniform1i(location(name), value);
 	}
 	// ------------------------------------------------------------------------
 	void setFloat(const std::string &name, float value) const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		glUniform1f(location(name), value);
 	}
 	// ------------------------------------------------------------------------
 	void setVec2(const std::string &name, const glm::vec2 &value) const
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform2fv(location(name), 1, &value[0]);
 	}
 	void setVec2(const std::string &name, float x, float y) const
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		glUniform2f(location(name), x, y);
 	}
 	// ------------------------------------------------------------------------
 	void setVec3(const std::string &name, const glm::vec3 &value) const
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform3fv(location(name), 1, &value[0]);
 	}
 	void setVec3(const std::string &name, float x, float y, float z) const
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		glUniform3f(location(name), x, y, z);
 	}
 	// ------------------------------------------------------------------------
 	void setVec4(const std::string &name, const glm::vec4 &value) const
 	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform4fv(location(name), 1, &value[0]);
 	}
 	void setVec4(const std::string &name, float x, float y, float z, float w)
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		glUniform4f(location(name), x, y, z, w);
 	}
 	// ------------------------------------------------------------------------
 	void setMat2(const std::string &name, const glm::mat2 &mat) const
 	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix2fv(location(name), 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
 	void setMat3(const std::string &name, const glm::mat3 &mat) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix3fv(location(name), 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
 	void setMat4(const std::string &name, const glm::mat4 &mat) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix4fv(location(name), 1, GL_FALSE, &mat[0][0]);
 	}
 
 private:
+	std::unordered_map<std::string, GLint> uniforms;
+	unsigned long long key;
+	double start;
+	unsigned int vertex, fragment, geometry;
+	bool pending, prepared;
+
+	// submits the compile and link of the program into ID; ready() collects the result
+	// ------------------------------------------------------------------------
+	void compile(const char* vertexCode, const char* fragmentCode, const char* geometryCode)
+	{
+		const char* vShaderCode = vertexCode;
+		const char * fShaderCode = fragmentCode;
+		// 2. compile shaders
+		// vertex shader
+		vertex = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(vertex, 1, &vShaderCode, NULL);
+		glCompileShader(vertex);
+		// fragment Shader
+		fragment = glCreateShader(GL_FRAGMENT_SHADER);
+		glShaderSource(fragment, 1, &fShaderCode, NULL);
+		glCompileShader(fragment);
+		// if geometry shader is given, compile geometry shader
+		if (geometryCode != nullptr)
+		{
+			const char * gShaderCode = geometryCode;
+			geometry = glCreateShader(GL_GEOMETRY_SHADER);
+			glShaderSource(geometry, 1, &gShaderCode, NULL);
+			glCompileShader(geometry);
+		}
+		// shader Program
+		ID = glCreateProgram();
+		glAttachShader(ID, vertex);
+		glAttachShader(ID, fragment);
+		if (geometry != 0)
+			glAttachShader(ID, geometry);
+		programCache().prepare(ID);
+		glLinkProgram(ID);
+	}
+	// records the location of every active uniform, so no setter has to ask the driver
+	// ------------------------------------------------------------------------
+	void reflectUniforms()
+	{
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::string name(maxLength > 0 ? maxLength : 1, '\0');
+		for (GLint i = 0; i < count; i++)
+		{
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(ID, (GLuint)i, maxLength, &length, &size, &type, &name[0]);
+			std::string uniformName(name.c_str(), length);
+			GLint uniformLocation = glGetUniformLocation(ID, uniformName.c_str());
+			if (uniformLocation < 0)
+				continue; // members of uniform blocks have no location
+			uniforms[uniformName] = uniformLocation;
+			// arrays are reported as "name[0]"; make them reachable as "name" too
+			if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+				uniforms[uniformName.substr(0, uniformName.size() - 3)] = uniformLocation;
+		}
+	}
+
 	// utility function for checking shader compilation/linking errors.
 	// ------------------------------------------------------------------------
 	void checkCompileErrors(GLuint shader, std::string type)
@@ -0,0 +1,51 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+// Capacity must be a power of two; push fails instead of blocking when the queue is full.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+	static_assert((Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+public:
+	SpscQueue() : head(0), tail(0) {}
+
+	// producer side
+	bool push(const T &value)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == Capacity)
+			return false;
+		items[t & (Capacity - 1)] = value;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer side
+	bool pop(T &value)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+			return false;
+		value = items[h & (Capacity - 1)];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const
+	{
+		return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+	}
+
+private:
+	T items[Capacity];
+	// the indices live on separate cache lines so the two threads do not share one
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<size_t> tail;
+};
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include <glad/glad.h>
+
+#include "mesh.h"
+
+#include <cstring>
+#include <initializer_list>
+
+// Ring buffer for vertex data that changes every frame. One buffer object is split into
+// FRAMES regions; each frame writes into its own region through an unsynchronized mapping,
+// and a fence placed at the end of the frame keeps the region from being overwritten
+// until the GPU has finished reading it FRAMES frames later.
+class StreamBuffer
+{
+public:
+	static const int FRAMES = 3;
+
+	StreamBuffer() : VBO(0), regionBytes(1 << 20), frame(0), cursor(0), frameBytes(0), lastFrameBytes(0), waits(0)
+	{
+		for (int i = 0; i < FRAMES; i++)
+			fences[i] = 0;
+	}
+
+	// Waits until the GPU is done with the region of this frame, then starts writing at its beginning
+	void beginFrame()
+	{
+		frame = (frame + 1) % FRAMES;
+		cursor = frame * regionBytes;
+		frameBytes = 0;
+		if (fences[frame] != 0)
+		{
+			GLenum status = glClientWaitSync(fences[frame], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+			if (status == GL_TIMEOUT_EXPIRED)
+			{
+				waits++;
+				while (glClientWaitSync(fences[frame], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+			}
+			glDeleteSync(fences[frame]);
+			fences[frame] = 0;
+		}
+	}
+
+	// Marks the end of the draws reading this frame's region
+	void endFrame()
+	{
+		if (VBO != 0 && frameBytes > 0)
+			fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		lastFrameBytes = frameBytes;
+	}
+
+	// A VAO whose attributes (stride and offsets in floats) read from the stream buffer
+	GLuint createLayout(GLsizei stride, std::initializer_list<VertexAttribute> attributes)
+	{
+		create();
+		GLuint VAO;
+		glGenVertexArrays(1, &VAO);
+		glState().bindVertexArray(VAO);
+		glState().bindBuffer(GL_ARRAY_BUFFER, VBO);
+		for (const VertexAttribute &attribute : attributes)
+		{
+			glVertexAttribPointer(attribute.index, attribute.size, GL_FLOAT, GL_FALSE, stride * sizeof(float), (void*)(attribute.offset * sizeof(float)));
+			glEnableVertexAttribArray(attribute.index);
+		}
+		glState().bindVertexArray(0);
+		glState().bindBuffer(GL_ARRAY_BUFFER, 0);
+		return VAO;
+	}
+
+	// Copies vertices (stride in floats) into this frame's region and returns the index of the
+	// first one, to be used as the first argument of glDrawArrays with a layout VAO
+	GLint upload(const float *vertices, GLsizeiptr bytes, GLsizei stride)
+	{
+		create();
+		GLsizeiptr strideBytes = stride * sizeof(float);
+		GLintptr offset = (cursor + strideBytes - 1) / strideBytes * strideBytes;
+		if (bytes > regionBytes)
+		{
+			// grow every region; the old storage is orphaned so pending draws keep their data
+			while (regionBytes < bytes)
+				regionBytes *= 2;
+			reallocate();
+			offset = frame * regionBytes;
+		}
+		else if (offset + bytes > (frame + 1) * regionBytes)
+		{
+			// this frame overflowed its region: orphan the storage instead of waiting
+			reallocate();
+			offset = frame * regionBytes;
+		}
+		if (bytes > 0)
+		{
+			glState().bindBuffer(GL_ARRAY_BUFFER, VBO);
+			void *ptr = glMapBufferRange(GL_ARRAY_BUFFER, offset, bytes, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+			if (ptr != NULL)
+			{
+				memcpy(ptr, vertices, bytes);
+				glUnmapBuffer(GL_ARRAY_BUFFER);
+			}
+		}
+		cursor = offset + bytes;
+		frameBytes += bytes;
+		return (GLint)(offset / strideBytes);
+	}
+
+	// Bytes written during the last complete frame
+	GLsizeiptr streamedBytes() const
+	{
+		return lastFrameBytes;
+	}
+
+	// Frames that had to block on the GPU before reusing their region
+	int stalls() const
+	{
+		return waits;
+	}
+
+	GLsizeiptr gpuBytes() const
+	{
+		return VBO != 0 ? regionBytes * FRAMES : 0;
+	}
+
+private:
+	GLuint VBO;
+	GLsync fences[FRAMES];
+	GLsizeiptr regionBytes;
+	int frame;
+	GLintptr cursor;
+	GLsizeiptr frameBytes, lastFrameBytes;
+	int waits;
+
+	void create()
+	{
+		if (VBO != 0)
+			return;
+		glGenBuffers(1, &VBO);
+		glState().bindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, regionBytes * FRAMES, NULL, GL_STREAM_DRAW);
+		glState().bindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	void reallocate()
+	{
+		glState().bindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, regionBytes * FRAMES, NULL, GL_STREAM_DRAW);
+		glState().bindBuffer(GL_ARRAY_BUFFER, 0);
+		for (int i = 0; i < FRAMES; i++)
+		{
+			if (fences[i] != 0)
+				glDeleteSync(fences[i]);
+			fences[i] = 0;
+		}
+	}
+};
+
+// The stream buffer shared by all homework modules
+inline StreamBuffer &streamBuffer()
+{
+	static StreamBuffer stream;
+	return stream;
+}
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef STROKECAPTURE_H
+#define STROKECAPTURE_H
+
+#include <glm/glm.hpp>
+
+#include "spscqueue.h"
+#include "curvefit.h"
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// A finished freehand stroke: the fitted cubic chain and how many raw samples it replaced
+struct FittedStroke
+{
+	std::vector<glm::vec2> chain;
+	int samples;
+};
+
+// Captures freehand strokes at full cursor event rate. The input callbacks push samples into a
+// lock-free queue; a worker thread sleeps until samples arrive, drains them and fits them to a chain
+// of cubic Bezier segments, publishing a preview while drawing and the final chain when the stroke ends.
+// A full queue drops samples, but never the begin or end of a stroke: those wait for room, since
+// without an end the stroke would never close and the next one would be merged into it.
+class StrokeCapture
+{
+public:
+	StrokeCapture() : stopping(false), tolerance(0.005f), dropped(0), previewVersion(0) {}
+
+	~StrokeCapture()
+	{
+		stopping = true;
+		wakeWorker();
+		if (worker.joinable())
+			worker.join();
+	}
+
+	// producer side, called from the GLFW callbacks
+	void begin(glm::vec2 position)
+	{
+		if (!worker.joinable())
+			worker = std::thread(&StrokeCapture::run, this);
+		push(position, SAMPLE_BEGIN);
+	}
+
+	void addSample(glm::vec2 position)
+	{
+		push(position, SAMPLE_POINT);
+	}
+
+	void end(glm::vec2 position)
+	{
+		push(position, SAMPLE_END);
+	}
+
+	void setTolerance(float value)
+	{
+		tolerance = value;
+	}
+
+	int droppedSamples() const
+	{
+		return dropped;
+	}
+
+	// Moves the strokes finished since the last call into out
+	void takeFinished(std::vector<FittedStroke> &out)
+	{
+		std::lock_guard<std::mutex> lock(resultMutex);
+		for (size_t i = 0; i < finished.size(); i++)
+			out.push_back(finished[i]);
+		finished.clear();
+	}
+
+	// Copies the fit of the stroke in progress; returns false if it has not changed since version
+	bool preview(std::vector<glm::vec2> &chain, int &version)
+	{
+		std::lock_guard<std::mutex> lock(resultMutex);
+		if (version == previewVersion)
+			return false;
+		chain = current;
+		version = previewVersion;
+		return true;
+	}
+
+private:
+	enum SampleType {
+		SAMPLE_POINT,
+		SAMPLE_BEGIN,
+		SAMPLE_END
+	};
+
+	struct Sample
+	{
+		glm::vec2 position;
+		int type;
+	};
+
+	// refit the stroke in progress after this many new samples
+	static const size_t PREVIEW_INTERVAL = 32;
+
+	SpscQueue<Sample, 8192> queue;
+	std::thread worker;
+	std::atomic<bool> stopping;
+	std::atomic<float> tolerance;
+	std::atomic<int> dropped;
+	std::mutex wakeMutex;
+	std::condition_variable wake;
+
+	std::mutex resultMutex;
+	std::vector<FittedStroke> finished;
+	std::vector<glm::vec2> current;
+	int previewVersion;
+
+	void push(glm::vec2 position, int type)
+	{
+		Sample sample = { position, type };
+		while (!queue.push(sample))
+		{
+			if (type == SAMPLE_POINT)
+			{
+				dropped++;
+				return;
+			}
+			// the worker is draining, so a slot frees up within one sample
+			wakeWorker();
+			std::this_thread::yield();
+		}
+		wakeWorker();
+	}
+
+	// Taking the mutex orders the push before the worker's check, so no wakeup is lost
+	void wakeWorker()
+	{
+		{
+			std::lock_guard<std::mutex> lock(wakeMutex);
+		}
+		wake.notify_one();
+	}
+
+	void publishPreview(const std::vector<glm::vec2> &chain)
+	{
+		std::lock_guard<std::mutex> lock(resultMutex);
+		current = chain;
+		previewVersion++;
+	}
+
+	void run()
+	{
+		std::vector<glm::vec2> raw;
+		size_t fittedSize = 0;
+		bool active = false;
+		while (!stopping)
+		{
+			Sample sample;
+			while (queue.pop(sample))
+			{
+				if (sample.type == SAMPLE_BEGIN)
+				{
+					raw.clear();
+					fittedSize = 0;
+					active = true;
+				}
+				if (!active)
+					continue;
+				raw.push_back(sample.position);
+				if (sample.type == SAMPLE_END)
+				{
+					FittedStroke stroke;
+					stroke.chain = CurveFitter::fit(raw, tolerance);
+					stroke.samples = (int)raw.size();
+					{
+						std::lock_guard<std::mutex> lock(resultMutex);
+						if (stroke.chain.size() >= 4)
+							finished.push_back(stroke);
+						current.clear();
+						previewVersion++;
+					}
+					raw.clear();
+					active = false;
+				}
+			}
+			if (active && raw.size() >= fittedSize + PREVIEW_INTERVAL)
+			{
+				publishPreview(CurveFitter::fit(raw, tolerance));
+				fittedSize = raw.size();
+			}
+			std::unique_lock<std::mutex> lock(wakeMutex);
+			wake.wait(lock, [this] { return stopping || !queue.empty(); });
+		}
+	}
+};
+
+#endif
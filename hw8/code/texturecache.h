@@ -0,0 +1,428 @@
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include <GLFW/glfw3.h>
+
+#include "stb_image.h"
+#include "blockcompress.h"
+#include "mappedfile.h"
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <functional>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+// One mip level inside the pixels of a TextureData; the sizes are in texels even when compressed
+struct TextureLevel
+{
+	int width, height;
+	size_t offset, bytes;
+};
+
+// Pixels of a texture with its whole mip chain, either mapped from the cache or built in memory.
+// Compressed levels are stored as rows of 4x4 blocks, which are then the rows to upload.
+struct TextureData
+{
+	int width, height, channels;
+	// a BlockFormat; BLOCK_NONE for plain pixels
+	int format;
+	// quality of the compressed level 0 against the image, and the size it had uncompressed
+	double psnr;
+	size_t rawBytes;
+	std::vector<TextureLevel> levels;
+	std::vector<unsigned char> memory;
+	MappedFile file;
+	// start of level 0 in memory or in the mapped file
+	const unsigned char *pixels;
+
+	TextureData() : width(0), height(0), channels(0), format(BLOCK_NONE), psnr(0.0), rawBytes(0), pixels(NULL) {}
+
+	const unsigned char *level(size_t i) const
+	{
+		return pixels + levels[i].offset;
+	}
+
+	// Rows of texels, or of blocks, in a level
+	int rowCount(size_t i) const
+	{
+		return format == BLOCK_NONE ? levels[i].height : (levels[i].height + 3) / 4;
+	}
+
+	size_t rowBytes(size_t i) const
+	{
+		return levels[i].bytes / rowCount(i);
+	}
+};
+
+// Halves an image with a 2x2 box filter; the new size is rounded down like GL mip levels, and a
+// side of 1 is reused for both taps. Four and one channel rows run 16 source bytes per SSE step.
+inline void downsampleBox(const unsigned char *src, int width, int height, int channels, unsigned char *dst)
+{
+	int outWidth = width > 1 ? width / 2 : 1;
+	int outHeight = height > 1 ? height / 2 : 1;
+	size_t rowBytes = (size_t)width * channels;
+	for (int y = 0; y < outHeight; y++)
+	{
+		const unsigned char *row0 = src + (size_t)(2 * y) * rowBytes;
+		const unsigned char *row1 = height > 1 ? row0 + rowBytes : row0;
+		unsigned char *out = dst + (size_t)y * outWidth * channels;
+		int x = 0;
+#ifdef TEXTURE_USE_SSE
+		if (width > 1 && (channels == 4 || channels == 1))
+		{
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i two = _mm_set1_epi16(2);
+			// 16 source bytes give 2 RGBA or 8 grey output pixels
+			int step = 16 / (2 * channels);
+			for (; x + step <= outWidth; x += step)
+			{
+				__m128i a = _mm_loadu_si128((const __m128i *)(row0 + 2 * x * channels));
+				__m128i b = _mm_loadu_si128((const __m128i *)(row1 + 2 * x * channels));
+				// vertical sums as 16 bit
+				__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+				__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+				__m128i sum;
+				if (channels == 4)
+				{
+					// each half holds two pixels; add the pixel pairs
+					sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+				}
+				else
+				{
+					// add neighbouring lanes into 32 bit and narrow them back
+					const __m128i ones = _mm_set1_epi16(1);
+					sum = _mm_packs_epi32(_mm_madd_epi16(lo, ones), _mm_madd_epi16(hi, ones));
+				}
+				sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+				_mm_storel_epi64((__m128i *)(out + x * channels), _mm_packus_epi16(sum, sum));
+			}
+		}
+#endif
+		for (; x < outWidth; x++)
+		{
+			int x0 = 2 * x, x1 = width > 1 ? 2 * x + 1 : 2 * x;
+			for (int c = 0; c < channels; c++)
+			{
+				int total = row0[x0 * channels + c] + row0[x1 * channels + c] + row1[x0 * channels + c] + row1[x1 * channels + c];
+				out[x * channels + c] = (unsigned char)((total + 2) >> 2);
+			}
+		}
+	}
+}
+
+// Builds the mip chain of an image into one block of memory, level 0 first
+inline void buildMipChain(const unsigned char *image, int width, int height, int channels, TextureData &data)
+{
+	data.width = width;
+	data.height = height;
+	data.channels = channels;
+	data.levels.clear();
+	size_t total = 0;
+	int w = width, h = height;
+	for (;;)
+	{
+		TextureLevel level = { w, h, total, (size_t)w * h * channels };
+		data.levels.push_back(level);
+		total += level.bytes;
+		if (w == 1 && h == 1)
+			break;
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+	data.memory.resize(total);
+	memcpy(data.memory.data(), image, data.levels[0].bytes);
+	for (size_t i = 1; i < data.levels.size(); i++)
+	{
+		const TextureLevel &source = data.levels[i - 1];
+		downsampleBox(data.memory.data() + source.offset, source.width, source.height, channels, data.memory.data() + data.levels[i].offset);
+	}
+	data.pixels = data.memory.data();
+	data.format = BLOCK_NONE;
+	data.psnr = 0.0;
+	data.rawBytes = total;
+}
+
+// Bits of the formats a texture may be compressed to, given what the driver can sample
+inline unsigned int blockFormatMask(bool s3tc, bool bptc)
+{
+	return (s3tc ? (1u << BLOCK_BC1) | (1u << BLOCK_BC3) : 0u) | (bptc ? 1u << BLOCK_BC7 : 0u);
+}
+
+// Opaque images get BC1 at half the size of the others, unless only BC7 is there. Images with
+// alpha prefer BC7, which codes it with the color, over BC3. Grey images stay uncompressed.
+inline int chooseBlockFormat(const unsigned char *rgba, int width, int height, int channels, unsigned int allowed)
+{
+	if (channels != 4)
+		return BLOCK_NONE;
+	bool opaque = true;
+	for (size_t i = 0; i < (size_t)width * height && opaque; i++)
+		opaque = rgba[4 * i + 3] == 255;
+	if (opaque && (allowed & (1u << BLOCK_BC1)))
+		return BLOCK_BC1;
+	if (allowed & (1u << BLOCK_BC7))
+		return BLOCK_BC7;
+	if (allowed & (1u << BLOCK_BC3))
+		return BLOCK_BC3;
+	return BLOCK_NONE;
+}
+
+// Replaces the plain mip chain of data with its block compressed levels, on threadCount threads
+// as compressImage
+inline void compressMipChain(TextureData &data, int format, unsigned int threadCount = 0)
+{
+	std::vector<TextureLevel> levels;
+	size_t total = 0;
+	for (size_t i = 0; i < data.levels.size(); i++)
+	{
+		TextureLevel level = { data.levels[i].width, data.levels[i].height, total, compressedSize(data.levels[i].width, data.levels[i].height, format) };
+		levels.push_back(level);
+		total += level.bytes;
+	}
+	std::vector<unsigned char> memory(total);
+	for (size_t i = 0; i < levels.size(); i++)
+	{
+		double error = compressImage(data.level(i), levels[i].width, levels[i].height, format, memory.data() + levels[i].offset, threadCount);
+		if (i == 0)
+			data.psnr = psnr(error, (double)levels[0].width * levels[0].height * (format == BLOCK_BC1 ? 3 : 4));
+	}
+	data.levels.swap(levels);
+	data.memory.swap(memory);
+	data.pixels = data.memory.data();
+	data.format = format;
+}
+
+// Converted textures on disk, so that a run after the first neither decodes images nor builds
+// mips. Files are texturecache/<key>.tex: a header, the level table, then every level packed
+// tightly. The key hashes the image path; the header keeps the size and time of the source,
+// so an edited image is converted again. 2 and 3 channel images are stored as RGBA. RGBA images
+// are block compressed to the best format the driver allows; the allowed formats are kept in
+// the header, so a file made for another driver is converted again.
+// Used from the loader's worker threads; the counters are atomic, and images are compressed on
+// the calling worker, as the workers already keep the cores busy.
+class TextureCache
+{
+public:
+	TextureCache() : hits(0), conversions(0), microseconds(0) {}
+
+	// Maps the converted image, or decodes, converts and stores it. False if it cannot be read at
+	// all. allowed is a blockFormatMask.
+	bool load(const std::string &path, unsigned int allowed, TextureData &data)
+	{
+		double start = glfwGetTime();
+		struct stat source;
+		if (stat(path.c_str(), &source) != 0)
+			return false;
+		std::string cachePath = fileName(path);
+		if (map(cachePath, source, allowed, data))
+		{
+			hits++;
+			microseconds += (long long)((glfwGetTime() - start) * 1e6);
+			return true;
+		}
+		int width, height, channels;
+		unsigned char *image = stbi_load(path.c_str(), &width, &height, &channels, 0);
+		if (image == NULL)
+			return false;
+		if (channels == 2 || channels == 3)
+		{
+			stbi_image_free(image);
+			image = stbi_load(path.c_str(), &width, &height, &channels, 4);
+			channels = 4;
+			if (image == NULL)
+				return false;
+		}
+		buildMipChain(image, width, height, channels, data);
+		int format = chooseBlockFormat(image, width, height, channels, allowed);
+		stbi_image_free(image);
+		if (format != BLOCK_NONE)
+			compressMipChain(data, format, 1);
+		write(cachePath, source, allowed, data);
+		conversions++;
+		microseconds += (long long)((glfwGetTime() - start) * 1e6);
+		return true;
+	}
+
+	int cachedTextures() const
+	{
+		return hits;
+	}
+
+	int convertedTextures() const
+	{
+		return conversions;
+	}
+
+	// Time spent getting textures ready for upload, whether mapped or converted
+	double milliseconds() const
+	{
+		return microseconds / 1000.0;
+	}
+
+private:
+	struct Header
+	{
+		char magic[4];
+		unsigned int version;
+		unsigned int format;
+		int width, height, channels;
+		unsigned int levelCount;
+		unsigned int allowed;
+		long long sourceSize, sourceTime;
+		double psnr;
+		unsigned long long rawBytes;
+	};
+
+	struct LevelEntry
+	{
+		int width, height;
+		unsigned long long offset, bytes;
+	};
+
+	static const unsigned int VERSION = 2;
+
+	std::atomic<int> hits, conversions;
+	std::atomic<long long> microseconds;
+
+	static const char *directory()
+	{
+		return "texturecache";
+	}
+
+	static std::string fileName(const std::string &path)
+	{
+		unsigned long long hash = 14695981039346656037ull;
+		for (size_t i = 0; i < path.size(); i++)
+		{
+			hash ^= (unsigned char)path[i];
+			hash *= 1099511628211ull;
+		}
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.tex", hash);
+		return std::string(directory()) + "/" + name;
+	}
+
+	bool map(const std::string &cachePath, const struct stat &source, unsigned int allowed, TextureData &data)
+	{
+		if (!data.file.open(cachePath))
+			return false;
+		const unsigned char *bytes = data.file.data();
+		size_t size = data.file.size();
+		Header header;
+		if (size < sizeof(Header))
+			return reject(data);
+		memcpy(&header, bytes, sizeof(Header));
+		if (memcmp(header.magic, "TEXC", 4) != 0 || header.version != VERSION || header.allowed != allowed || header.format > BLOCK_BC7
+			|| header.sourceSize != (long long)source.st_size || header.sourceTime != (long long)source.st_mtime)
+			return reject(data);
+		size_t tableEnd = sizeof(Header) + header.levelCount * sizeof(LevelEntry);
+		if (header.levelCount == 0 || header.levelCount > 32 || tableEnd > size
+			|| header.width <= 0 || header.height <= 0 || (header.channels != 1 && header.channels != 4))
+			return reject(data);
+		data.width = header.width;
+		data.height = header.height;
+		data.channels = header.channels;
+		data.format = (int)header.format;
+		data.psnr = header.psnr;
+		data.rawBytes = (size_t)header.rawBytes;
+		data.levels.clear();
+		// every level must have the size its place in the chain gives it and lie inside the file,
+		// or a truncated or damaged file would have the upload read past the mapping
+		size_t available = size - tableEnd;
+		int width = header.width, height = header.height;
+		for (unsigned int i = 0; i < header.levelCount; i++)
+		{
+			LevelEntry entry;
+			memcpy(&entry, bytes + sizeof(Header) + i * sizeof(LevelEntry), sizeof(LevelEntry));
+			size_t expected = header.format == BLOCK_NONE ? (size_t)width * height * header.channels : compressedSize(width, height, (int)header.format);
+			if (entry.width != width || entry.height != height || entry.bytes != expected
+				|| entry.offset > available || entry.bytes > available - entry.offset)
+				return reject(data);
+			width = width > 1 ? width / 2 : 1;
+			height = height > 1 ? height / 2 : 1;
+			TextureLevel level = { entry.width, entry.height, (size_t)entry.offset, (size_t)entry.bytes };
+			data.levels.push_back(level);
+		}
+		data.pixels = bytes + tableEnd;
+		// touch every page here on the worker, so the GL thread's copies never wait on the disk
+		volatile unsigned char sink = 0;
+		for (size_t offset = tableEnd; offset < size; offset += 4096)
+			sink ^= bytes[offset];
+		(void)sink;
+		return true;
+	}
+
+	static bool reject(TextureData &data)
+	{
+		data.file.close();
+		data.levels.clear();
+		return false;
+	}
+
+	void write(const std::string &cachePath, const struct stat &source, unsigned int allowed, const TextureData &data)
+	{
+#ifdef _WIN32
+		_mkdir(directory());
+#else
+		mkdir(directory(), 0755);
+#endif
+		Header header;
+		memcpy(header.magic, "TEXC", 4);
+		header.version = VERSION;
+		header.format = (unsigned int)data.format;
+		header.width = data.width;
+		header.height = data.height;
+		header.channels = data.channels;
+		header.levelCount = (unsigned int)data.levels.size();
+		header.allowed = allowed;
+		header.sourceSize = (long long)source.st_size;
+		header.sourceTime = (long long)source.st_mtime;
+		header.psnr = data.psnr;
+		header.rawBytes = data.rawBytes;
+		// written under a temporary name, so a reader never maps half a file; the name is unique to
+		// the write, since two workers may convert the same image at once
+		static std::atomic<unsigned int> writes(0);
+		char suffix[48];
+		snprintf(suffix, sizeof(suffix), ".%zx.%u.part", std::hash<std::thread::id>()(std::this_thread::get_id()), writes++);
+		std::string temporary = cachePath + suffix;
+		{
+			std::ofstream file(temporary.c_str(), std::ios::binary);
+			file.write((const char *)&header, sizeof(header));
+			for (size_t i = 0; i < data.levels.size(); i++)
+			{
+				LevelEntry entry = { data.levels[i].width, data.levels[i].height, data.levels[i].offset, data.levels[i].bytes };
+				file.write((const char *)&entry, sizeof(entry));
+			}
+			file.write((const char *)data.pixels, data.memory.size());
+			if (!file)
+			{
+				file.close();
+				std::remove(temporary.c_str());
+				return;
+			}
+		}
+		std::remove(cachePath.c_str());
+		std::rename(temporary.c_str(), cachePath.c_str());
+	}
+};
+
+inline TextureCache &textureCache()
+{
+	static TextureCache cache;
+	return cache;
+}
+
+#endif
@@ -0,0 +1,477 @@
+#ifndef TEXTURELOADER_H
+#define TEXTURELOADER_H
+
+#include <glad/glad.h>
+
+#include "glstate.h"
+#include "glextensions.h"
+#include "texturecache.h"
+
+#include <algorithm>
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+
+typedef unsigned int TextureHandle;
+
+// Loads image files into immutable 2D textures without stalling frames. A pool of worker threads
+// maps the converted files from the texture cache, or decodes and converts them on first use;
+// once per frame update() copies at most a budget of rows into pixel buffer objects and uploads
+// the mip levels from them one after the other, so the driver transfers the pixels
+// asynchronously. Until its texture is complete a handle resolves to a grey placeholder.
+// RGBA images come from the cache block compressed when the driver samples BC1, BC3 or BC7,
+// and are uploaded a row of blocks at a time. Everything but the decoding happens on the GL thread.
+class TextureLoader
+{
+public:
+	// staging buffers in flight; when all are still read by the GPU the upload waits a frame
+	static const int STAGING_BUFFERS = 4;
+
+	TextureLoader() : stopping(false), placeholder(0), uploadBudget(4 << 20), lastFrameBytes(0)
+	{
+		for (int i = 0; i < STAGING_BUFFERS; i++)
+		{
+			staging[i].PBO = 0;
+			staging[i].bytes = 0;
+			staging[i].fence = 0;
+		}
+	}
+
+	~TextureLoader()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		jobReady.notify_all();
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	// Starts decoding an image file; the handle can be drawn with at once
+	TextureHandle load(const char *path)
+	{
+		startWorkers();
+		textures.push_back(Texture());
+		textures.back().path = path;
+		// handles are never reused, so a decode finishing after release() is recognized and dropped
+		TextureHandle handle = (TextureHandle)textures.size();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			Job job = { handle, path, blockFormatMask(glExtensions().s3tc, glExtensions().bptc) };
+			jobs.push_back(job);
+		}
+		jobReady.notify_one();
+		return handle;
+	}
+
+	// The texture to bind: the placeholder until every row has been uploaded
+	GLuint texture(TextureHandle handle)
+	{
+		const Texture &texture = textures[handle - 1];
+		if (texture.complete)
+			return texture.id;
+		if (placeholder == 0)
+			createPlaceholder();
+		return placeholder;
+	}
+
+	bool ready(TextureHandle handle) const
+	{
+		return textures[handle - 1].complete;
+	}
+
+	// Deletes the texture, or drops it if it is still being decoded
+	void release(TextureHandle handle)
+	{
+		Texture &texture = textures[handle - 1];
+		if (texture.id != 0)
+			glDeleteTextures(1, &texture.id);
+		std::string path = texture.path;
+		texture = Texture();
+		texture.path = path;
+		texture.released = true;
+		uploads.erase(std::remove(uploads.begin(), uploads.end(), handle), uploads.end());
+		// deleted textures are unbound by GL behind the cache's back
+		glState().invalidate();
+	}
+
+	// Called once per frame: takes the finished decodes and spends the upload budget on them
+	void update()
+	{
+		std::vector<Decoded> arrived;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			arrived.swap(decoded);
+		}
+		for (size_t i = 0; i < arrived.size(); i++)
+			allocate(arrived[i]);
+
+		lastFrameBytes = 0;
+		if (uploads.empty())
+			return;
+		// rows of 1 and 3 channel images are tightly packed
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		while (!uploads.empty() && lastFrameBytes < uploadBudget)
+		{
+			Texture &texture = textures[uploads.front() - 1];
+			const TextureData &data = *texture.data;
+			const TextureLevel &level = data.levels[texture.level];
+			GLsizeiptr rowBytes = (GLsizeiptr)data.rowBytes(texture.level);
+			int rowCount = data.rowCount(texture.level);
+			// whole rows, at least one, as many as the rest of the budget allows
+			int rows = (int)std::max<GLsizeiptr>(1, (uploadBudget - lastFrameBytes) / rowBytes);
+			rows = std::min(rows, rowCount - texture.uploadedRows);
+			Staging *buffer = freeStaging();
+			if (buffer == NULL)
+				break;
+			copy(*buffer, data.level(texture.level) + texture.uploadedRows * rowBytes, rows * rowBytes);
+			glState().bindTexture(GL_TEXTURE_2D, texture.id);
+			if (data.format == BLOCK_NONE)
+			{
+				glTexSubImage2D(GL_TEXTURE_2D, texture.level, 0, texture.uploadedRows, level.width, rows, pixelFormat(data.channels), GL_UNSIGNED_BYTE, 0);
+			}
+			else
+			{
+				// a row of blocks is 4 texels high, except at the bottom of the level
+				int y = texture.uploadedRows * 4;
+				glCompressedTexSubImage2D(GL_TEXTURE_2D, texture.level, 0, y, level.width, std::min(rows * 4, level.height - y),
+					internalFormat(data), (GLsizei)(rows * rowBytes), 0);
+			}
+			buffer->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			texture.uploadedRows += rows;
+			lastFrameBytes += rows * rowBytes;
+			if (texture.uploadedRows == rowCount)
+			{
+				texture.level++;
+				texture.uploadedRows = 0;
+			}
+			if (texture.level == (int)data.levels.size())
+			{
+				// every level came from the cache, so no mipmaps are generated; unmaps the file
+				texture.data.reset();
+				texture.complete = true;
+				uploads.pop_front();
+			}
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+
+	// Texture memory of one handle, counted from the moment its storage exists
+	GLsizeiptr gpuBytes(TextureHandle handle) const
+	{
+		return handle != 0 ? textures[handle - 1].bytes : 0;
+	}
+
+	GLsizeiptr gpuBytes() const
+	{
+		GLsizeiptr bytes = 0;
+		for (size_t i = 0; i < textures.size(); i++)
+			bytes += textures[i].bytes;
+		for (int i = 0; i < STAGING_BUFFERS; i++)
+			bytes += staging[i].bytes;
+		return bytes;
+	}
+
+	// Textures still decoding or uploading
+	int pendingTextures() const
+	{
+		int pending = 0;
+		for (size_t i = 0; i < textures.size(); i++)
+		{
+			if (!textures[i].complete && !textures[i].released && !textures[i].failed)
+				pending++;
+		}
+		return pending;
+	}
+
+	// Bytes uploaded during the last update
+	GLsizeiptr uploadedBytes() const
+	{
+		return lastFrameBytes;
+	}
+
+	// What a texture became, for reporting; format is a BlockFormat and psnr is 0 for raw pixels
+	struct TextureInfo
+	{
+		const char *path;
+		int format;
+		double psnr;
+		GLsizeiptr bytes, rawBytes;
+	};
+
+	// Handles run from 1 to textureCount()
+	int textureCount() const
+	{
+		return (int)textures.size();
+	}
+
+	TextureInfo info(TextureHandle handle) const
+	{
+		const Texture &texture = textures[handle - 1];
+		TextureInfo info = { texture.path.c_str(), texture.format, texture.psnr, texture.bytes, texture.rawBytes };
+		return info;
+	}
+
+	// Memory the resident textures would take uncompressed, less what they take
+	GLsizeiptr savedBytes() const
+	{
+		GLsizeiptr bytes = 0;
+		for (size_t i = 0; i < textures.size(); i++)
+			bytes += textures[i].rawBytes - textures[i].bytes;
+		return bytes;
+	}
+
+private:
+	struct Job
+	{
+		TextureHandle handle;
+		std::string path;
+		// the block formats the driver can sample, a blockFormatMask
+		unsigned int allowed;
+	};
+
+	// data is NULL if the file could not be read
+	struct Decoded
+	{
+		TextureHandle handle;
+		std::unique_ptr<TextureData> data;
+	};
+
+	struct Texture
+	{
+		GLuint id;
+		std::string path;
+		// held until every level is uploaded
+		std::unique_ptr<TextureData> data;
+		// rows of blocks for compressed levels
+		int level, uploadedRows;
+		int format;
+		double psnr;
+		GLsizeiptr bytes, rawBytes;
+		bool complete, released, failed;
+		Texture() : id(0), level(0), uploadedRows(0), format(BLOCK_NONE), psnr(0.0), bytes(0), rawBytes(0), complete(false), released(false), failed(false) {}
+	};
+
+	struct Staging
+	{
+		GLuint PBO;
+		GLsizeiptr bytes;
+		GLsync fence;
+	};
+
+	// shared with the workers, guarded by mutex
+	std::mutex mutex;
+	std::condition_variable jobReady;
+	std::deque<Job> jobs;
+	std::vector<Decoded> decoded;
+	bool stopping;
+	std::vector<std::thread> workers;
+
+	// GL thread only
+	std::vector<Texture> textures;
+	std::deque<TextureHandle> uploads;
+	Staging staging[STAGING_BUFFERS];
+	GLuint placeholder;
+	GLsizeiptr uploadBudget, lastFrameBytes;
+
+	void startWorkers()
+	{
+		if (!workers.empty())
+			return;
+		// leave a core to the render thread
+		unsigned int count = std::thread::hardware_concurrency();
+		count = count > 1 ? std::min(count - 1, 4u) : 1;
+		for (unsigned int i = 0; i < count; i++)
+			workers.push_back(std::thread(&TextureLoader::run, this));
+	}
+
+	void run()
+	{
+		for (;;)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				jobReady.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if (stopping)
+					return;
+				job = jobs.front();
+				jobs.pop_front();
+			}
+			Decoded image;
+			image.handle = job.handle;
+			image.data.reset(new TextureData());
+			if (!textureCache().load(job.path, job.allowed, *image.data))
+			{
+				std::cout << "Failed to load texture " << job.path << std::endl;
+				image.data.reset();
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			decoded.push_back(std::move(image));
+		}
+	}
+
+	static GLenum internalFormat(const TextureData &data)
+	{
+		switch (data.format)
+		{
+		case BLOCK_BC1:
+			return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		case BLOCK_BC3:
+			return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		case BLOCK_BC7:
+			return GL_COMPRESSED_RGBA_BPTC_UNORM;
+		}
+		switch (data.channels)
+		{
+		case 1:
+			return GL_R8;
+		case 2:
+			return GL_RG8;
+		case 3:
+			return GL_RGB8;
+		default:
+			return GL_RGBA8;
+		}
+	}
+
+	static GLenum pixelFormat(int channels)
+	{
+		switch (channels)
+		{
+		case 1:
+			return GL_RED;
+		case 2:
+			return GL_RG;
+		case 3:
+			return GL_RGB;
+		default:
+			return GL_RGBA;
+		}
+	}
+
+	// Creates the storage of a loaded image and queues its levels for upload
+	void allocate(Decoded &image)
+	{
+		Texture &texture = textures[image.handle - 1];
+		if (texture.released || image.data == NULL)
+		{
+			texture.failed = image.data == NULL;
+			return;
+		}
+		texture.data = std::move(image.data);
+		const TextureData &data = *texture.data;
+		GLsizei levels = (GLsizei)data.levels.size();
+
+		glGenTextures(1, &texture.id);
+		glState().bindTexture(GL_TEXTURE_2D, texture.id);
+		if (glExtensions().textureStorage)
+		{
+			glExtensions().texStorage2D(GL_TEXTURE_2D, levels, internalFormat(data), data.width, data.height);
+		}
+		else
+		{
+			// mutable storage with the same levels as the immutable one would have
+			for (GLsizei i = 0; i < levels; i++)
+			{
+				if (data.format == BLOCK_NONE)
+					glTexImage2D(GL_TEXTURE_2D, i, internalFormat(data), data.levels[i].width, data.levels[i].height, 0,
+						pixelFormat(data.channels), GL_UNSIGNED_BYTE, NULL);
+				else
+					glCompressedTexImage2D(GL_TEXTURE_2D, i, internalFormat(data), data.levels[i].width, data.levels[i].height, 0,
+						(GLsizei)data.levels[i].bytes, NULL);
+			}
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		if (data.channels <= 2)
+		{
+			// grey and grey-alpha images are sampled as grey, not as red and green
+			GLint swizzle[4] = { GL_RED, GL_RED, GL_RED, data.channels == 1 ? GL_ONE : GL_GREEN };
+			glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+		}
+		texture.format = data.format;
+		texture.psnr = data.psnr;
+		if (data.format == BLOCK_NONE)
+		{
+			// RGB is padded to 4 bytes by drivers; the mip chain adds a third
+			texture.bytes = (GLsizeiptr)data.width * data.height * (data.channels == 3 ? 4 : data.channels) * 4 / 3;
+			texture.rawBytes = texture.bytes;
+		}
+		else
+		{
+			// blocks are stored as they are
+			texture.bytes = 0;
+			for (GLsizei i = 0; i < levels; i++)
+				texture.bytes += (GLsizeiptr)data.levels[i].bytes;
+			texture.rawBytes = (GLsizeiptr)data.rawBytes;
+		}
+		uploads.push_back(image.handle);
+	}
+
+	// A staging buffer the GPU no longer reads from, or NULL if all of them are busy
+	Staging *freeStaging()
+	{
+		for (int i = 0; i < STAGING_BUFFERS; i++)
+		{
+			Staging &buffer = staging[i];
+			if (buffer.fence != 0)
+			{
+				if (glClientWaitSync(buffer.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+					continue;
+				glDeleteSync(buffer.fence);
+				buffer.fence = 0;
+			}
+			return &buffer;
+		}
+		return NULL;
+	}
+
+	// Fills a staging buffer and leaves it bound as the unpack source
+	void copy(Staging &buffer, const unsigned char *pixels, GLsizeiptr bytes)
+	{
+		if (buffer.PBO == 0)
+			glGenBuffers(1, &buffer.PBO);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.PBO);
+		if (bytes > buffer.bytes)
+		{
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+			buffer.bytes = bytes;
+		}
+		void *ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (ptr != NULL)
+		{
+			memcpy(ptr, pixels, bytes);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		}
+	}
+
+	void createPlaceholder()
+	{
+		unsigned char grey[4] = { 128, 128, 128, 255 };
+		glGenTextures(1, &placeholder);
+		glState().bindTexture(GL_TEXTURE_2D, placeholder);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
+};
+
+// The texture loader shared by all homework modules
+inline TextureLoader &textureLoader()
+{
+	static TextureLoader loader;
+	return loader;
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef UNIFORMBLOCKS_H
+#define UNIFORMBLOCKS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Fixed binding points of the uniform blocks shared by all programs
+const GLuint CAMERA_BLOCK_BINDING = 0;
+const GLuint LIGHT_BLOCK_BINDING = 1;
+
+// GLSL declarations of the blocks, to be spliced into shader sources after #version.
+// Light members are read as light.ambient, light.position, ... like the old Light struct.
+#define CAMERA_BLOCK_GLSL \
+	"layout (std140) uniform CameraBlock {\n" \
+	"	mat4 view;\n" \
+	"	mat4 projection;\n" \
+	"	vec3 viewPos;\n" \
+	"};\n"
+
+#define LIGHT_BLOCK_GLSL \
+	"layout (std140) uniform LightBlock {\n" \
+	"	vec3 ambient;\n" \
+	"	vec3 diffuse;\n" \
+	"	vec3 specular;\n" \
+	"	vec3 position;\n" \
+	"	mat4 lightSpaceMatrix;\n" \
+	"} light;\n"
+
+// std140 mirrors of the blocks: every vec3 takes a whole 16 byte slot
+struct CameraBlock
+{
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::vec4 viewPos;
+};
+
+struct LightBlock
+{
+	glm::vec4 ambient;
+	glm::vec4 diffuse;
+	glm::vec4 specular;
+	glm::vec4 position;
+	glm::mat4 lightSpaceMatrix;
+};
+
+// One uniform buffer attached to a fixed binding point. The binding is made once; a frame
+// only rewrites the contents, so programs can be switched without sending any uniform.
+template <typename T>
+class UniformBuffer
+{
+public:
+	explicit UniformBuffer(GLuint binding) : UBO(0), binding(binding) {}
+
+	void update(const T &data)
+	{
+		if (UBO == 0)
+		{
+			glGenBuffers(1, &UBO);
+			glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+			glBufferData(GL_UNIFORM_BUFFER, sizeof(T), NULL, GL_DYNAMIC_DRAW);
+			glBindBufferBase(GL_UNIFORM_BUFFER, binding, UBO);
+		}
+		else
+		{
+			glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+		}
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+private:
+	GLuint UBO;
+	GLuint binding;
+};
+
+inline UniformBuffer<CameraBlock> &cameraBuffer()
+{
+	static UniformBuffer<CameraBlock> buffer(CAMERA_BLOCK_BINDING);
+	return buffer;
+}
+
+inline UniformBuffer<LightBlock> &lightBuffer()
+{
+	static UniformBuffer<LightBlock> buffer(LIGHT_BLOCK_BINDING);
+	return buffer;
+}
+
+// Attaches the shared blocks a program declares to their binding points
+inline void bindUniformBlocks(GLuint program)
+{
+	GLuint camera = glGetUniformBlockIndex(program, "CameraBlock");
+	if (camera != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, camera, CAMERA_BLOCK_BINDING);
+	GLuint light = glGetUniformBlockIndex(program, "LightBlock");
+	if (light != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, light, LIGHT_BLOCK_BINDING);
+}
+
+#endif